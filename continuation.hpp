@@ -271,6 +271,78 @@ continuation<Sig> callcc(F f,  Args&&... args) {
 }
 
 
+/**
+ * Stack requirements for a continuation created by callcc: the
+ * allocator to obtain the stack from, its size and whether the
+ * context preserves its floating point control state (see
+ * preserve_fpenv).
+ **/
+template<class StackAlloc>
+struct stack_spec {
+    StackAlloc allocator;
+    std::size_t size;
+    bool fpenv;
+};
+
+/**
+ * Request a 'size' bytes stack from 'alloc' for a new continuation,
+ * instead of the allocator default stack_size:
+ *
+ *   auto gen = callcc(stack_hint(16*1024), f);
+ *   auto parser = callcc(stack_hint(64*1024*1024, mmap_stack_allocator()), g);
+ **/
+template<class StackAlloc = default_stack_allocator>
+stack_spec<StackAlloc> stack_hint(std::size_t size, 
+                                  StackAlloc alloc = StackAlloc()) {
+    return stack_spec<StackAlloc>{ std::move(alloc), size, false };
+}
+
+/**
+ * Request that the continuation created with 'stack' keeps its own
+ * MXCSR and x87 control word (rounding, denormal and exception
+ * masks) across switches, starting with those current at creation;
+ * the contexts that did not opt in keep sharing those of their
+ * thread. Switches between those contexts do not pay for saving
+ * them. The context must switch through the continuations it is
+ * handed or creates, not to a context that last suspended itself
+ * into another one that did not opt in (see
+ * details/switch_fpenv.hpp):
+ *
+ *   auto c = callcc(preserve_fpenv(), f);
+ *   auto d = callcc(preserve_fpenv(stack_hint(64*1024)), g);
+ **/
+template<class StackAlloc>
+stack_spec<StackAlloc> preserve_fpenv(stack_spec<StackAlloc> stack) {
+    stack.fpenv = true;
+    return stack;
+}
+
+inline stack_spec<default_stack_allocator> preserve_fpenv() {
+    return preserve_fpenv(stack_hint(default_stack_allocator::stack_size));
+}
+
+template<class F, 
+         class StackAlloc,
+         class... Args,
+         class Sig = typename details::deduce_signature<F>::type>
+continuation<Sig> callcc(stack_spec<StackAlloc> stack, F f, Args&&... args) {
+    return details::create_continuation<Sig> 
+        (gpd::bind(std::move(f), placeholder<0>(), 
+                   std::forward<Args>(args)...),
+         std::move(stack.allocator), stack.size, stack.fpenv); 
+}
+
+template<class Sig, 
+         class F, 
+         class StackAlloc,
+         class... Args>
+continuation<Sig> callcc(stack_spec<StackAlloc> stack, F f, Args&&... args) {
+    return details::create_continuation<Sig>
+        (gpd::bind(std::move(f), placeholder<0>(), 
+                   std::forward<Args>(args)...),
+         std::move(stack.allocator), stack.size, stack.fpenv);
+}
+
 // execute f on existing continuation c, passing to f the current
 // continuation. When f returns, c is resumed; F must return a continuation to c.
 //
@@ -295,7 +367,7 @@ auto callcc(continuation<IntoSignature> c, F f, Args&&... args) as
                               std::forward<Args>(args)...)));
 
 /**
- * The following four oerloads are not strictly necessary but may
+ * The following overloads are not strictly necessary but may
  * speedup compilation by skipping the argument packing via bind.
  */
 template<class F, 
@@ -310,6 +382,22 @@ continuation<Sig> callcc(F f) {
     return details::create_continuation<Sig>(std::move(f));
 }
 
+template<class F, 
+         class StackAlloc,
+         class Sig = typename details::deduce_signature<F>::type>
+continuation<Sig> callcc(stack_spec<StackAlloc> stack, F f) {
+    return details::create_continuation<Sig> 
+        (std::move(f), std::move(stack.allocator), stack.size, stack.fpenv);
+}
+
+template<class Sig, 
+         class F,
+         class StackAlloc>
+continuation<Sig> callcc(stack_spec<StackAlloc> stack, F f) {
+    return details::create_continuation<Sig>
+        (std::move(f), std::move(stack.allocator), stack.size, stack.fpenv);
+}
+
 template<class NewIntoSignature,
          class IntoSignature, 
          class F>
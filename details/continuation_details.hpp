@@ -16,9 +16,10 @@ template<class StackAlloc>
 struct cleanup_trampoline_args {
     StackAlloc allocator; 
     void * stackp;
+    size_t stack_size;
     std::exception_ptr excp;
 
-    void operator()() { allocator.deallocate(stackp); }
+    void operator()() { allocator.deallocate(stackp, stack_size); }
     cleanup_trampoline_args(cleanup_trampoline_args&&) = default;
 };
 
@@ -29,8 +30,9 @@ switch_pair cleanup_trampoline(parm_t arg, cont)  {
         ([&]{ 
             auto alloc = std::move(argsp->allocator); // Must not throw, othwise we leak memory
             void * stackp = argsp->stackp;
+            size_t stack_size = argsp->stack_size;
             argsp->~cleanup_trampoline_args<StackAlloc>();
-            alloc.deallocate(stackp);
+            alloc.deallocate(stackp, stack_size);
         });
     if (argsp->excp) std::rethrow_exception(argsp->excp);
     return switch_pair{{0}, 0};
@@ -42,6 +44,7 @@ struct startup_trampoline_args { // POD
     F functor;
     StackAlloc allocator;
     void * stackp;
+    size_t stack_size;
     startup_trampoline_args(startup_trampoline_args&&) = default;
 };
 
@@ -68,7 +71,7 @@ template<class Continuation, class F, class StackAlloc>
 switch_pair startup_trampoline(parm_t arg, cont sp) {
     auto argsp = static_cast<startup_trampoline_args<F, StackAlloc>*>(arg);
     cleanup_trampoline_args<StackAlloc> cleanup_args
-    { std::move(argsp->allocator), argsp->stackp, 0 };
+    { std::move(argsp->allocator), argsp->stackp, argsp->stack_size, 0 };
     try {
         auto f(std::move(argsp->functor)); 
         switch_pair pair = {sp,0};
@@ -99,14 +102,16 @@ template<class Signature,
          class StackAlloc = default_stack_allocator>
 continuation<Signature> 
 create_continuation(F f, StackAlloc alloc = StackAlloc(), 
-                    size_t stack_size = StackAlloc::stack_size)  {
+                    size_t stack_size = StackAlloc::stack_size,
+                    bool preserve_fpenv = false)  {
     void * stackp = alloc.allocate(stack_size);
-    cont cs { stack_bottom(stackp, stack_size) };
+    cont cs { preserve_fpenv ? fpenv_stack_bottom(stackp, stack_size) 
+                             : stack_bottom(stackp, stack_size) };
 
     typedef typename continuation<Signature>::rsignature rsignature;
 
     startup_trampoline_args<F, StackAlloc> xargs{ 
-        std::move(f), std::move(alloc), stackp
+        std::move(f), std::move(alloc), stackp, stack_size
     };
     return continuation<Signature>
         (execute_into(&xargs, cs, &startup_trampoline<continuation<rsignature>, 
@@ -1,5 +1,17 @@
 #ifndef GPD_SWITCH_BASE_HPP
 #define GPD_SWITCH_BASE_HPP
+
+/**
+ * Defining GPD_INLINE_SWITCH selects the inline, minimal clobber,
+ * context switch in switch_base_alt.hpp instead of the out of line
+ * one below. The two are not interoperable: the macro must be
+ * defined consistently by every translation unit of a program,
+ * libtask included.
+ **/
+#ifdef GPD_INLINE_SWITCH
+#include "switch_base_alt.hpp"
+#else
+#include "switch_fpenv.hpp"
 #include <cassert>
 #include <stdint.h>
 #include <stddef.h>
@@ -12,11 +24,23 @@ struct cont {
     explicit operator bool() const { return sp;}
 };
 
-inline void * stack_bottom(void * vp, size_t size) {
+// The frame of a new context: its floating point word (see
+// switch_fpenv.hpp), then room for the callee saved registers.
+// Tagged, so that the context starting it leaves its own state
+// behind if it opted in. A suspended context that opted in keeps its
+// state in its word, as details::fpenv_current_word.
+inline void * stack_bottom(void * vp, size_t size, uintptr_t fpenv = 0) {
     char * p = (char*)vp;
     p += size ;
-    p -= 7*sizeof(void*);  
-    return p;
+    p -= 8*sizeof(void*);  
+    *(uintptr_t*)p = fpenv;
+    return p + 1;
+}
+
+// As stack_bottom, for a context preserving its floating point
+// control state; it starts with the state current at creation.
+inline void * fpenv_stack_bottom(void * vp, size_t size) {
+    return stack_bottom(vp, size, details::fpenv_current_word());
 }
 
 struct switch_pair {
@@ -45,6 +69,66 @@ typedef switch_pair trampoline_t(parm_t parm, cont calling_continuation);
 
 /**/
 
+// The floating point state of the calling thread, for the asm below.
+extern "C" __attribute__((used, noinline))
+inline details::fpenv_thread * gpd_fpenv_thread() {
+    return &details::fpenv_local();
+}
+
+// %rax = gpd_fpenv_thread(), preserving the argument registers; with
+// the stack aligned as after GPD_SAVE_REGISTERS.
+#define GPD_FPENV_THREAD                        \
+    "pushq %rdi            \n\t"                \
+    "pushq %rsi            \n\t"                \
+    "pushq %rdx            \n\t"                \
+    "call gpd_fpenv_thread@PLT \n\t"            \
+    "popq %rdx             \n\t"                \
+    "popq %rsi             \n\t"                \
+    "popq %rdi             \n\t"                \
+/**/
+
+/**
+ * Switch the floating point control state from the running context
+ * to the frame of the suspended context 'target', whose word is on
+ * top, through the state of their thread in %rax (a
+ * details::fpenv_thread). If either opted in, push the word of the
+ * running context and set %r8 to 1, the tag of its continuation;
+ * otherwise leave %r8 at 0.
+ **/
+#define GPD_SWITCH_FPENV(target)                \
+    "movq (%rax), %rcx     \n\t"                \
+    "movzbl (" target "), %r8d \n\t"            \
+    "andl $1, %r8d         \n\t"                \
+    "movq %r8, (%rax)      \n\t"                \
+    "testq %rcx, %rcx      \n\t"                \
+    "jz 1f                 \n\t"                \
+    "pushq $1              \n\t"                \
+    "stmxcsr 4(%rsp)       \n\t"                \
+    "fnstcw 2(%rsp)        \n\t"                \
+    "testl %r8d, %r8d      \n\t"                \
+    "jnz 2f                \n\t"                \
+    "ldmxcsr 8(%rax)       \n\t"                \
+    "fldcw 12(%rax)        \n\t"                \
+    "movl $1, %r8d         \n\t"                \
+    "jmp 3f                \n\t"                \
+    "1:                    \n\t"                \
+    "testl %r8d, %r8d      \n\t"                \
+    "jz 3f                 \n\t"                \
+    "pushq $0              \n\t"                \
+    "stmxcsr 8(%rax)       \n\t"                \
+    "fnstcw 12(%rax)       \n\t"                \
+    "2:                    \n\t"                \
+    "ldmxcsr 4(" target ") \n\t"                \
+    "fldcw 2(" target ")   \n\t"                \
+    "3:                    \n\t"                \
+/**/
+static_assert(offsetof(details::fpenv_thread, running) == 0 &&
+              offsetof(details::fpenv_thread, shared.mxcsr) == 8 &&
+              offsetof(details::fpenv_thread, shared.fpucw) == 12,
+              "GPD_SWITCH_FPENV depends on this layout");
+
+// An untagged target takes the switch as it is without floating
+// point state; a tagged one the path at the end.
 extern "C"
 switch_pair /*rax, rdx*/
 stack_switch_impl(cont sp /*rdi*/, parm_t parm /*rsi*/);
@@ -54,6 +138,8 @@ asm volatile (
     ".type stack_switch_impl, @function \n\t"            
     ".align 16                     \n\t"                           
     "stack_switch_impl:            \n\t"         
+    "testb $1, %dil        \n\t"
+    "jnz .Lgpd_switch_fpenv \n\t"
     GPD_SAVE_REGISTERS
     "movq %rsi, %rdx       \n\t"  // parm-> switch_pair::parm
     "movq %rsp, %rax       \n\t"  // rsp -> switch_pair::sp
@@ -61,6 +147,18 @@ asm volatile (
     GPD_RESTORE_REGISTERS
     "popq %rdi             \n\t"
     "jmp *%rdi             \n\t"  // jump to ret address
+    ".Lgpd_switch_fpenv:   \n\t"
+    GPD_SAVE_REGISTERS
+    GPD_FPENV_THREAD
+    "andq $-2, %rdi        \n\t"
+    GPD_SWITCH_FPENV("%rdi")
+    "movq %rsi, %rdx       \n\t"
+    "movq %rsp, %rax       \n\t"
+    "orq %r8, %rax         \n\t"
+    "leaq 8(%rdi), %rsp    \n\t"  // past the word of the target
+    GPD_RESTORE_REGISTERS
+    "popq %rdi             \n\t"
+    "jmp *%rdi             \n\t"
     );
 
 extern "C"
@@ -72,12 +170,25 @@ asm volatile (
     ".type execute_into_impl, @function \n\t"            
     ".align 16                     \n\t"                           
     "execute_into_impl:            \n\t"                
+    "testb $1, %sil        \n\t"
+    "jnz .Lgpd_execute_into_fpenv \n\t"
     GPD_SAVE_REGISTERS
     "movq %rsp, %rbx       \n\t"
     "movq %rsi, %rsp       \n\t" 
     "movq %rbx, %rsi       \n\t"
     GPD_RESTORE_REGISTERS
     "jmp *%rdx             \n\t"  //tail call (rdi is passed through)
+    ".Lgpd_execute_into_fpenv: \n\t"
+    GPD_SAVE_REGISTERS
+    GPD_FPENV_THREAD
+    "andq $-2, %rsi        \n\t"
+    GPD_SWITCH_FPENV("%rsi")
+    "movq %rsp, %rbx       \n\t"
+    "orq %r8, %rbx         \n\t"
+    "leaq 8(%rsi), %rsp    \n\t" 
+    "movq %rbx, %rsi       \n\t"
+    GPD_RESTORE_REGISTERS
+    "jmp *%rdx             \n\t"
     );  
 
 inline switch_pair
@@ -93,5 +204,5 @@ execute_into(parm_t parm, cont sp, trampoline_t * ex) {
 
 
 }
+#endif // GPD_INLINE_SWITCH
 #endif
-
@@ -1,25 +1,41 @@
 #ifndef GPD_SWITCH_BASE_ALT_HPP
 #define GPD_SWITCH_BASE_ALT_HPP
+#include "switch_fpenv.hpp"
 #include <cassert>
 #include <stdint.h>
 #include <stddef.h>
 
+/**
+ * Inline context switch, selected by defining GPD_INLINE_SWITCH (see
+ * switch_base.hpp).
+ *
+ * Instead of calling an out of line function that pushes all
+ * callee-saved registers, the switch is an asm statement that
+ * declares them clobbered, so the compiler only spills the registers
+ * that are actually live at the switch point.
+ *
+ * A suspended context leaves on its stack its frame pointer and its
+ * resume address, and, if its continuation is tagged, its floating
+ * point word on top (see switch_fpenv.hpp). The state of a context
+ * that opted in stays in its suspended switch, which restores it on
+ * resume.
+ * The resuming side drops the word, pops the address and jumps to it
+ * with the suspending context stack pointer in rbx, the parameter in
+ * rdx and an optional trampoline in rcx. As execution can't be
+ * unwound from the middle of an asm statement, trampolines are not
+ * run on top of the target stack like the out of line version does,
+ * but called by the target itself once it has resumed; exceptions
+ * thrown by a trampoline then propagate through ordinary C++ frames.
+ **/
 namespace gpd {
 
 typedef void* parm_t;
 
 struct cont { 
-    void * rsp; 
-    explicit operator bool() const { return rsp;}
+    void * sp; 
+    explicit operator bool() const { return sp;}
 };
 
-void * stack_bottom(void * vp, size_t size) {
-    char * p = (char*)vp;
-    p += size ;
-    p -= 7*sizeof(void*);  
-    return p;
-}
-
 struct switch_pair {
     cont   sp;
     parm_t parm;
@@ -27,48 +43,171 @@ struct switch_pair {
 
 typedef switch_pair trampoline_t(parm_t parm, cont calling_continuation); 
 
-#define GPD_CLOBBER_LIST                                               \
-     "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"              \
-        , "xmm0", "xmm1", "xmm2" , "xmm3" , "xmm4" , "xmm5" , "xmm6" , "xmm7" \
-        , "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" \
-        ,"st",  "st(1)", "st(2)", "st(3)", "st(4)", "st(5)", "st(6)", "st(7)" \
-    , "memory"                                                          \
+// First resume address of a new stack: call the trampoline passed by
+// execute_into. Startup trampolines never return.
+extern "C" void gpd_inline_switch_entry();
+asm (                            
+    ".text                         \n\t"                              
+    ".weak gpd_inline_switch_entry \n\t"                   
+    ".type gpd_inline_switch_entry, @function \n\t"            
+    ".align 16                     \n\t"                           
+    "gpd_inline_switch_entry:      \n\t"         
+    "movq %rdx, %rdi       \n\t"  // parm
+    "movq %rbx, %rsi       \n\t"  // calling continuation
+    "xorl %ebp, %ebp       \n\t"
+    "andq $-16, %rsp       \n\t"
+    "callq *%rcx           \n\t"
+    "ud2                   \n\t"
+    );
+
+// The frame of a new context: its floating point word, then its
+// resume address. Tagged, so that the context starting it leaves its
+// own state behind if it opted in.
+inline void * stack_bottom(void * vp, size_t size, uintptr_t fpenv = 0) {
+    char * p = (char*)vp;
+    p += size ;
+    p -= 8*sizeof(void*);  
+    *reinterpret_cast<uintptr_t*>(p) = fpenv;
+    *reinterpret_cast<void**>(p + sizeof(void*)) = 
+        reinterpret_cast<void*>(&gpd_inline_switch_entry);
+    return p + 1;
+}
+
+// As stack_bottom, for a context preserving its floating point
+// control state; it starts with the state current at creation, which
+// bit 1 of its word tells apart from a suspended context.
+inline void * fpenv_stack_bottom(void * vp, size_t size) {
+    return stack_bottom(vp, size, details::fpenv_current_word() | 2);
+}
+
+#ifdef __AVX512F__
+#define GPD_CLOBBER_LIST_AVX512                                         \
+    , "xmm16", "xmm17", "xmm18", "xmm19", "xmm20", "xmm21", "xmm22", "xmm23" \
+    , "xmm24", "xmm25", "xmm26", "xmm27", "xmm28", "xmm29", "xmm30", "xmm31" \
+    , "k1", "k2", "k3", "k4", "k5", "k6", "k7"                          \
+    /**/
+#else
+#define GPD_CLOBBER_LIST_AVX512
+#endif
+
+#define GPD_CLOBBER_LIST                                                \
+    "rax", "rsi", "rdi", "r8", "r9", "r10", "r11"                       \
+    , "r12", "r13", "r14", "r15"                                        \
+    , "xmm0", "xmm1", "xmm2" , "xmm3" , "xmm4" , "xmm5" , "xmm6" , "xmm7" \
+    , "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" \
+    GPD_CLOBBER_LIST_AVX512                                             \
+    , "st",  "st(1)", "st(2)", "st(3)", "st(4)", "st(5)", "st(6)", "st(7)" \
+    , "memory", "cc"                                                    \
+    /**/
+
+namespace details {
+// 'suspend' runs once the resume address is pushed, 'suspended' once
+// the stack pointer of the suspended context is in rbx.
+#define GPD_INLINE_SWITCH_ASM(suspend, suspended)                       \
+    asm volatile (                                                      \
+        "leaq -128(%%rsp), %%rsp   \n\t"  /* skip the red zone */      \
+        "pushq %%rbp               \n\t"                                \
+        "leaq 1f(%%rip), %%rax     \n\t"                                \
+        "pushq %%rax               \n\t"                                \
+        suspend                                                         \
+        "xchgq %%rbx, %%rsp        \n\t"                                \
+        suspended                                                       \
+        "popq %%rax                \n\t"                                \
+        "jmpq *%%rax               \n\t"                                \
+        "1:                        \n\t"                                \
+        "popq %%rbp                \n\t"                                \
+        "leaq 128(%%rsp), %%rsp    \n\t"                                \
+        : "+b"(sp), "+d"(parm), "+c"(ex)                                \
+        :                                                               \
+        : GPD_CLOBBER_LIST                                              \
+        )                                                               \
     /**/
 
+// Suspend the current context and resume the one at 'sp' passing it
+// 'parm' and 'ex'. On return, the three arguments hold the values
+// passed by whoever resumed us.
+__attribute__((always_inline))
+inline void inline_switch(void *& sp, parm_t& parm, trampoline_t *& ex) {
+    GPD_INLINE_SWITCH_ASM("", "");
+}
+
+// Same, leaving a floating point word, 'word', and a tagged
+// continuation.
+#define GPD_INLINE_SWITCH_FPENV(word)                                   \
+    GPD_INLINE_SWITCH_ASM("pushq $" #word " \n\t", "orq $1, %%rbx \n\t")
+
+__attribute__((always_inline))
+inline void inline_switch_fpenv(void *& sp, parm_t& parm, 
+                                trampoline_t *& ex) {
+    GPD_INLINE_SWITCH_FPENV(1);
+}
+
+__attribute__((always_inline))
+inline void inline_switch_shared(void *& sp, parm_t& parm, 
+                                 trampoline_t *& ex) {
+    GPD_INLINE_SWITCH_FPENV(0);
+}
+
+inline switch_pair resume(void * sp, parm_t parm, trampoline_t * ex) {
+    if (__builtin_expect(ex != 0, false))
+        return ex(parm, cont{sp});
+    return switch_pair{cont{sp}, parm};
+}
+
+// To a tagged continuation, see switch_fpenv.hpp.
+__attribute__((noinline))
+inline switch_pair fpenv_switch(void * sp, parm_t parm, trampoline_t * ex) {
+    auto& thread = fpenv_local();
+    uintptr_t self = thread.running;
+    uintptr_t * frame = fpenv_frame(sp);
+    uintptr_t target = *frame;
+    thread.running = target & 1;
+    sp = frame + 1; // past the word
+    if (!self && !(target & 1)) {
+        inline_switch(sp, parm, ex);
+        return resume(sp, parm, ex);
+    }
+    fpenv own;
+    if (self)
+        own.save();
+    else
+        thread.shared.save();
+    if (target & 2)
+        fpenv_of_word(target).restore(); // new, with its own
+    else if (!(target & 1))
+        thread.shared.restore();
+    if (self) {
+        inline_switch_fpenv(sp, parm, ex);
+        own.restore();
+    } else
+        inline_switch_shared(sp, parm, ex);
+    return resume(sp, parm, ex);
+}
+}
 
 inline switch_pair
 stack_switch_impl(cont sp, parm_t parm) {
-    asm volatile (
-        "pushq $1f          \n\t"
-        "xchg  %%rbx, %%rsp \n\t"
-        "popq  %%rsi        \n\t"
-        "jmp  *%%rsi        \n\t"
-        "1:                 \n\t"
-        :  "+b"(sp.rsp), "+d"(parm) 
-        :  
-        : "rsi", "rdi", "rcx", "rax", "rbp",
-          GPD_CLOBBER_LIST
-        );
-    return switch_pair{sp, parm};
+    void * p = sp.sp;
+    trampoline_t * ex = 0;
+    if (__builtin_expect(details::fpenv_tagged(p), false))
+        return details::fpenv_switch(p, parm, ex);
+    details::inline_switch(p, parm, ex);
+    return details::resume(p, parm, ex);
+}
+
+inline switch_pair
+stack_switch(cont sp, parm_t parm) {
+    return stack_switch_impl(sp, parm);
 }
 
-typedef switch_pair trampoline_t(parm_t /* rdi */ parm, cont calling_continuation /*rsi*/); 
-   
 inline
 switch_pair 
 execute_into(parm_t parm, cont sp, trampoline_t * ex) {
-    switch_pair ret;
-    asm volatile ( 
-        "pushq $1f          \n\t"
-        "xchg  %%rsi, %%rsp \n\t"
-        "jmp  *%%rcx        \n\t"
-        "1:                \n\t"
-        : "=d"(ret.parm), "=b"(ret.sp.rsp)
-        : "D"(parm), "S"(sp.rsp), "c"(ex) 
-        : "rbp",
-          GPD_CLOBBER_LIST
-        );
-    return ret;
+    void * p = sp.sp;
+    if (__builtin_expect(details::fpenv_tagged(p), false))
+        return details::fpenv_switch(p, parm, ex);
+    details::inline_switch(p, parm, ex);
+    return details::resume(p, parm, ex);
 }
 
 }
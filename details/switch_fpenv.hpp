@@ -0,0 +1,82 @@
+#ifndef GPD_SWITCH_FPENV_HPP
+#define GPD_SWITCH_FPENV_HPP
+#include <stdint.h>
+
+/**
+ * Floating point control state (MXCSR and the x87 control word) is
+ * not preserved by default. A context created with preserve_fpenv
+ * opts in: the state is saved when switching out of it and restored
+ * when switching back into it. The contexts that did not opt in
+ * share the state of their thread, which is saved when switching
+ * into an opted in context from one of them and restored when
+ * switching back out to one of them.
+ *
+ * Only switches to a tagged continuation (bit 0 of its stack pointer
+ * set) look at that state; the others are left as cheap as without
+ * it. A continuation is tagged if its frame starts with a word, 0 or
+ * with the low bit set if the context opted in: those of new
+ * contexts, and those suspended by a switch from or to an opted in
+ * context, which are the ones the latter is handed. Every thread
+ * keeps the bit of its running context, up to date as of the last
+ * tagged switch.
+ *
+ * An opted in context must then only switch to tagged continuations:
+ * the one passed to its function, those returned by its switches,
+ * those of opted in or new contexts. Switching to another one, e.g.
+ * a context that last switched to a context that did not opt in,
+ * leaves the state of the former to the latter.
+ **/
+namespace gpd { namespace details {
+
+struct fpenv {
+    uint32_t mxcsr;
+    uint16_t fpucw;
+
+    void save() {
+        asm volatile ("stmxcsr %0 \n\t"
+                      "fnstcw %1  \n\t"
+                      : "=m"(mxcsr), "=m"(fpucw));
+    }
+
+    void restore() const {
+        asm volatile ("ldmxcsr %0 \n\t"
+                      "fldcw %1   \n\t"
+                      : : "m"(mxcsr), "m"(fpucw));
+    }
+};
+
+struct fpenv_thread {
+    uintptr_t running; // 1 if the running context opted in
+    fpenv shared;      // of the contexts that did not opt in, while
+                       // one that did is running
+};
+
+inline fpenv_thread& fpenv_local() {
+    static thread_local fpenv_thread state
+        __attribute__((tls_model("initial-exec"))) = { 0, {} };
+    return state;
+}
+
+// The word of an opted in context holding the current state: the low
+// bit set, the x87 control word in bytes 2-3, the MXCSR in bytes 4-7.
+inline uintptr_t fpenv_current_word() {
+    fpenv env;
+    env.save();
+    return uintptr_t(env.mxcsr) << 32 | uintptr_t(env.fpucw) << 16 | 1;
+}
+
+inline fpenv fpenv_of_word(uintptr_t word) {
+    return fpenv{ uint32_t(word >> 32), uint16_t(word >> 16) };
+}
+
+inline bool fpenv_tagged(void * sp) {
+    return uintptr_t(sp) & 1;
+}
+
+// The frame of the context of a tagged continuation.
+inline uintptr_t * fpenv_frame(void * sp) {
+    return reinterpret_cast<uintptr_t*>(uintptr_t(sp) & ~uintptr_t(1));
+}
+
+}}
+#endif
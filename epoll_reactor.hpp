@@ -0,0 +1,193 @@
+#ifndef GPD_EPOLL_REACTOR_HPP
+#define GPD_EPOLL_REACTOR_HPP
+#include "event.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+#include <vector>
+namespace gpd {
+
+/**
+ * Readiness notification for file descriptors, on top of epoll.
+ *
+ * At most one event per descriptor and direction can be waiting at
+ * any time; it is signaled, and forgotten, as soon as the descriptor
+ * is ready. Descriptors are registered one shot the first time they
+ * are waited for and re-armed with every wait, so that a close()
+ * needs no deregistration.
+ *
+ * Everything but notify() must be called by the owner thread.
+ **/
+struct epoll_reactor {
+    enum direction { read = 0, write = 1 };
+
+    epoll_reactor()
+        : epfd(::epoll_create1(EPOLL_CLOEXEC))
+        , evfd(::eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK))
+        , waiting(0)
+        , blocked(false) {
+        if (epfd == -1 || evfd == -1)
+            throw std::system_error(errno, std::system_category(),
+                                    "epoll_reactor");
+        ::epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = evfd;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+    }
+
+    epoll_reactor(const epoll_reactor&) = delete;
+
+    ~epoll_reactor() {
+        ::close(evfd);
+        ::close(epfd);
+    }
+
+    /// Signal 'e' once 'fd' is ready for 'dir'. Descriptors that do
+    /// not support polling, like regular files, are always ready.
+    void add(int fd, direction dir, event * e) {
+        if (std::size_t(fd) >= entries.size())
+            entries.resize(fd + 1);
+        auto& entry = entries[fd];
+        assert(!entry.waiters[dir]);
+        entry.waiters[dir] = e;
+        ++waiting;
+        int error = arm(fd, entry);
+        if (error == EPERM) {
+            entry.waiters[dir] = 0;
+            --waiting;
+            e->signal();
+        } else if (error) {
+            entry.waiters[dir] = 0;
+            --waiting;
+            throw std::system_error(error, std::system_category(),
+                                    "epoll_ctl");
+        }
+    }
+
+    /// Forget 'e', if not signaled yet.
+    void remove(int fd, direction dir, event * e) {
+        auto& entry = entries[fd];
+        if (entry.waiters[dir] == e) {
+            entry.waiters[dir] = 0;
+            --waiting;
+        }
+    }
+
+    /// Number of events waiting.
+    std::size_t size() const { return waiting; }
+
+    /// Signal every event waiting, ready or not. Return their count.
+    std::size_t signal_all() {
+        std::size_t signaled = 0;
+        for (auto& entry : entries)
+            for (auto& e : entry.waiters)
+                if (e) {
+                    --waiting;
+                    ++signaled;
+                    std::exchange(e, nullptr)->signal();
+                }
+        return signaled;
+    }
+
+    /// The epoll descriptor, readable when poll() has something to
+    /// do.
+    int native_handle() const { return epfd; }
+
+    /// Signal the events whose descriptor is ready. Block for up to
+    /// 'timeout_ms' milliseconds (-1 for ever) if nothing is, unless
+    /// block() returns false once the reactor is marked as blocked,
+    /// or notify() is called. Return the number of events signaled.
+    template<class Pred>
+    std::size_t poll(int timeout_ms, Pred&& block) {
+        if (timeout_ms) {
+            blocked.store(true); // seq_cst, pairs with notify
+            if (!block())
+                timeout_ms = 0;
+        }
+        ::epoll_event events[64];
+        int n = ::epoll_wait(epfd, events, 64, timeout_ms);
+        blocked.store(false, std::memory_order_relaxed);
+        std::size_t signaled = 0;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == evfd) {
+                std::uint64_t buf;
+                while (::read(evfd, &buf, sizeof(buf)) > 0)
+                    ;
+                continue;
+            }
+            auto& entry = entries[fd];
+            const std::uint32_t any = EPOLLERR|EPOLLHUP;
+            const std::uint32_t mask[] = { EPOLLIN|EPOLLRDHUP|any,
+                                           EPOLLOUT|any };
+            for (int dir = 0; dir < 2; ++dir)
+                if ((events[i].events & mask[dir]) && entry.waiters[dir]) {
+                    auto e = entry.waiters[dir];
+                    entry.waiters[dir] = 0;
+                    --waiting;
+                    ++signaled;
+                    e->signal();
+                }
+            // one shot: the other direction needs re-arming
+            if (entry.waiters[read] || entry.waiters[write])
+                arm(fd, entry);
+        }
+        return signaled;
+    }
+
+    std::size_t poll(int timeout_ms = 0) {
+        return poll(timeout_ms, [] { return true; });
+    }
+
+    /// Any thread. Wake up a blocked poll. Return true if it had to.
+    bool notify() {
+        if (!blocked.load())
+            return false;
+        std::uint64_t buf = 1;
+        while (::write(evfd, &buf, sizeof(buf)) == -1 && errno == EINTR)
+            ;
+        return true;
+    }
+
+private:
+    struct entry_t {
+        event * waiters[2] = { 0, 0 };
+        bool registered = false;
+    };
+
+    // Return errno on failure.
+    int arm(int fd, entry_t& entry) {
+        ::epoll_event ev = {};
+        ev.events = EPOLLONESHOT;
+        if (entry.waiters[read])  ev.events |= EPOLLIN|EPOLLRDHUP;
+        if (entry.waiters[write]) ev.events |= EPOLLOUT;
+        ev.data.fd = fd;
+        // the registration is gone if the descriptor was closed, or
+        // is a stale one if the number was reused: try both ways
+        int op = entry.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        for (int i = 0; i < 2; ++i) {
+            if (::epoll_ctl(epfd, op, fd, &ev) == 0) {
+                entry.registered = true;
+                return 0;
+            }
+            if (errno != ENOENT && errno != EEXIST)
+                return errno;
+            op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        }
+        return errno;
+    }
+
+    int epfd;
+    int evfd;
+    std::size_t waiting;
+    std::vector<entry_t> entries;
+    std::atomic<bool> blocked;
+};
+
+}
+#endif
@@ -400,19 +400,20 @@ auto wait_any_adl(CountdownLatch& latch, Waitable&... e) ->
 
 
 /// Wait entry points; simply defer to the customization points
+/// (which may throw, e.g. a cancelled scheduler wait).
 /// @{
 template<class WaitStrategy, class Waitable>
-void wait(WaitStrategy& how, Waitable& w) noexcept {
+void wait(WaitStrategy& how, Waitable& w) {
     wait_adl(how, w);
 }
 
 template<class WaitStrategy, class... Waitable>
-void wait_all(WaitStrategy& how, Waitable&... w) noexcept {
+void wait_all(WaitStrategy& how, Waitable&... w) {
     wait_all_adl(how, w...);
 }
 
 template<class WaitStrategy, class... Waitable>
-void wait_any(WaitStrategy& to, Waitable&... w) noexcept {
+void wait_any(WaitStrategy& to, Waitable&... w) {
     wait_any_adl(to, w...);
 }
 
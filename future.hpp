@@ -5,6 +5,7 @@
 #include <cassert>
 #include <deque>
 #include <thread>
+#include "continuation_exception.hpp"
 #include "event.hpp"
 #include "waiter.hpp"
 #include "forwarding.hpp"
@@ -16,6 +17,8 @@ template<class W, class F, class... Args>
 void eval_into(W& w, F&& f, Args&&... args) {
     try {
         w.set_value(std::forward<F>(f)(std::forward<Args>(args)...));
+    } catch(exit_exception&) {
+        throw; // a continuation being unwound
     } catch(...) {
         w.set_exception(std::current_exception());
     }
@@ -192,6 +195,15 @@ public:
         tstate->signal();
     }
     
+    void set_exception(std::exception_ptr e) {
+        if (!state)
+            throw std::future_error (std::future_errc::promise_already_satisfied);
+
+        auto tstate = std::exchange(state, nullptr);
+        tstate->set_exception(std::move(e));
+        tstate->signal();
+    }
+
     template<class E>
     void set_exception(E&& e) {
         if (!state)
@@ -37,6 +37,15 @@ struct mpsc_queue_base
         prev->m_next.store(n, std::memory_order_release);
     }
 
+    /// Push the chain [first, last], already linked through m_next,
+    /// with a single exchange. Consumers see the nodes in chain order.
+    void push_batch(node* first, node* last) {
+        last->m_next.store(0, std::memory_order_relaxed);
+        node* prev = m_head.exchange(last);
+        XASSERT(prev);
+        prev->m_next.store(first, std::memory_order_release);
+    }
+
     node * pop_unlocked() {
         auto tail = m_tail.m_next.load(std::memory_order_relaxed);
         if (tail == 0)
@@ -93,6 +102,13 @@ struct mpsc_queue_base
         return 0;
     }
 
+    /// Consumer only. Cheaper than peek(): might return false while
+    /// pop() cannot return anything yet, if a producer is preempted
+    /// mid-push.
+    bool empty() const {
+        return !m_tail.m_next.load(std::memory_order_relaxed);
+    }
+
     node * peek() {
         node* tail = m_tail.m_next.load(std::memory_order_acquire);
         if (tail == 0)
@@ -147,6 +163,10 @@ struct mpsc_queue : mpsc_queue_base {
         mpsc_queue_base::push_unlocked(n);
     }
 
+    void push_batch(node* first, node* last) {
+        mpsc_queue_base::push_batch(first, last);
+    }
+
     node *pop() {
         auto p = mpsc_queue_base::pop();
         XASSERT(p != & m_tail);
@@ -0,0 +1,173 @@
+#ifndef GPD_READY_QUEUE_HPP
+#define GPD_READY_QUEUE_HPP
+#include "node.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace gpd {
+
+/**
+ * Ready queue with priority classes: one intrusive FIFO per class
+ * and a bitmask of the non empty ones, so that push, pop and finding
+ * the highest class with work are all O(1). Class 0 is the highest.
+ *
+ * Within a class, each of 'Tenants' has a FIFO of its own, served
+ * in deficit round robin: a tenant gets its weight in credit when
+ * the cursor reaches it and is popped from while it has credit left,
+ * then the cursor moves to the next tenant with work. Every pop
+ * costs one unit, and charge() can add the actual cost of the node
+ * once known: a tenant overdrawn carries its debt and sits out turns
+ * until it is repaid. Over time each tenant with work gets a share
+ * of the cost proportional to its weight, however many nodes it has
+ * queued. The debt is capped to 'debt_rounds' rounds of weight, so
+ * that pop() skips a bounded number of turns, and neither credit nor
+ * debt is kept by a tenant once it has no work or is alone.
+ *
+ * Nodes are linked through gpd::node::m_next. Not thread safe, but
+ * for set_weight().
+ **/
+template<class Node, unsigned Classes, unsigned Tenants = 1>
+struct ready_queue {
+    static_assert(Classes > 0 && Classes <= 32, "unsupported class count");
+    static_assert(Tenants > 0 && Tenants <= 32, "unsupported tenant count");
+
+    static const unsigned classes = Classes;
+    static const unsigned tenants = Tenants;
+    static const unsigned debt_rounds = 8;
+
+    ready_queue() : mask(0), count(0) {
+        for (auto& w : weights)
+            w.store(1, std::memory_order_relaxed);
+    }
+    ready_queue(const ready_queue&) = delete;
+
+    void push(Node* n, unsigned cls, unsigned tenant = 0) {
+        assert(cls < Classes && tenant < Tenants);
+        auto& l = lanes[cls];
+        auto& q = l.queues[tenant];
+        n->m_next.store(0, std::memory_order_relaxed);
+        q.last->m_next.store(n, std::memory_order_relaxed);
+        q.last = n;
+        if (Tenants > 1)
+            l.mask |= 1u << tenant;
+        mask |= 1u << cls;
+        ++count;
+    }
+
+    /// The front of the highest non empty class, or null if empty.
+    Node* pop() {
+        return mask ? pop(top()) : 0;
+    }
+
+    /// The next node of class 'cls', or null if it is empty.
+    Node* pop(unsigned cls) {
+        auto& l = lanes[cls];
+        if (!(Tenants > 1 ? l.mask : mask & (1u << cls)))
+            return 0;
+        // a tenant alone keeps the turn, with a clean slate
+        if (Tenants > 1 && !(l.mask & (l.mask - 1))) {
+            l.cursor = __builtin_ctz(l.mask);
+            l.credits[l.cursor] = 0;
+        } else if (Tenants > 1) {
+            while (l.credits[l.cursor] <= 0 || !(l.mask & (1u << l.cursor))) {
+                l.cursor = next(l.mask, l.cursor);
+                l.credits[l.cursor] +=
+                    weights[l.cursor].load(std::memory_order_relaxed);
+            }
+            --l.credits[l.cursor];
+        }
+        unsigned t = Tenants > 1 ? l.cursor : 0;
+        auto& q = l.queues[t];
+        auto n = q.stub.m_next.load(std::memory_order_relaxed);
+        auto next = n->m_next.load(std::memory_order_relaxed);
+        q.stub.m_next.store(next, std::memory_order_relaxed);
+        if (!next) {
+            q.last = &q.stub;
+            if (Tenants == 1)
+                mask &= ~(1u << cls);
+            else {
+                l.credits[t] = 0;
+                l.mask &= ~(1u << t);
+                if (!l.mask)
+                    mask &= ~(1u << cls);
+            }
+        }
+        --count;
+        return static_cast<Node*>(n);
+    }
+
+    /// The highest class with ready nodes, or 'classes' if empty.
+    unsigned top() const {
+        return mask ? unsigned(__builtin_ctz(mask)) : Classes;
+    }
+
+    bool empty() const { return !mask; }
+
+    bool empty(unsigned cls) const { return !(mask & (1u << cls)); }
+
+    std::size_t size() const { return count; }
+
+    /// Charge 'cost' units to 'tenant' in class 'cls', on top of the
+    /// unit of the pop of its node, unless it has no nodes queued
+    /// there any more.
+    void charge(unsigned cls, unsigned tenant, std::int64_t cost) {
+        assert(cls < Classes && tenant < Tenants);
+        auto& l = lanes[cls];
+        if (!(l.mask & (1u << tenant)))
+            return;
+        std::int64_t floor = -std::int64_t(debt_rounds) *
+            weights[tenant].load(std::memory_order_relaxed);
+        l.credits[tenant] = std::max(l.credits[tenant] - cost, floor);
+    }
+
+    /// True if more than one tenant of class 'cls' has nodes queued,
+    /// i.e. if what pop(cls) returns is worth a charge().
+    bool shared(unsigned cls) const {
+        auto m = lanes[cls].mask;
+        return m & (m - 1);
+    }
+
+    /// Credit of 'tenant' in each round, 1 by default. Can be called
+    /// from any thread; takes effect from its next turn.
+    void set_weight(unsigned tenant, unsigned weight) {
+        assert(tenant < Tenants);
+        weights[tenant].store(weight ? weight : 1, std::memory_order_relaxed);
+    }
+
+    unsigned get_weight(unsigned tenant) const {
+        return weights[tenant].load(std::memory_order_relaxed);
+    }
+
+private:
+    // The first bit set in 'm' after 'cursor', wrapping around.
+    static unsigned next(std::uint32_t m, unsigned cursor) {
+        std::uint32_t after = m & ~((std::uint64_t(2) << cursor) - 1);
+        return __builtin_ctz(after ? after : m);
+    }
+
+    // with a stub head, so that push needs no branch
+    struct fifo {
+        fifo() : last(&stub) {}
+        node stub;
+        node * last;
+    };
+    // the bookkeeping first, on the cache line of the first queues
+    struct lane {
+        // tenants with work; with a single tenant, left at 0 for the
+        // class bit in the queue mask
+        std::uint32_t mask = 0;
+        unsigned cursor = Tenants - 1; // the first turn is tenant 0's
+        std::int64_t credits[Tenants] = {};
+        fifo queues[Tenants];
+    };
+    lane lanes[Classes];
+    std::uint32_t mask;
+    std::size_t count;
+    std::atomic<unsigned> weights[Tenants];
+};
+
+}
+#endif
@@ -0,0 +1,118 @@
+#ifndef GPD_SPIN_WAITER_HPP
+#define GPD_SPIN_WAITER_HPP
+#include "event.hpp"
+#include "futex.hpp"
+#include <chrono>
+#include <cstdint>
+#include <sched.h>
+namespace gpd {
+
+/// How long a spin_waiter tries before going to the next, more
+/// expensive, phase.
+struct spin_policy {
+    unsigned spins  = 1000; // 'pause' iterations
+    unsigned yields = 8;    // sched_yield calls
+};
+
+/// How many waits were resolved by each phase, and how many futex
+/// wake ups signal() had to issue.
+struct spin_stats {
+    std::uint64_t spin  = 0;
+    std::uint64_t yield = 0;
+    std::uint64_t park  = 0;
+    std::uint64_t wake  = 0;
+};
+
+// Adaptive futex based waiter: spins, then yields the cpu, then
+// blocks. signal() only pays for a system call if the waiter is
+// actually blocked.
+struct spin_waiter : waiter {
+    typedef std::chrono::steady_clock clock;
+
+    futex signal_counter = { 0 };
+    std::atomic<bool> parked = { false };
+    spin_policy policy;
+
+    explicit spin_waiter(spin_policy policy = {}) : policy(policy) {}
+
+    void reset() {
+        signal_counter.store(0, std::memory_order_relaxed);
+    }
+
+    void signal(event_ptr p) override final {
+        p.release();
+        auto v = --signal_counter;
+        if (v == 0 && parked.load()) {
+            signal_counter.signal();
+            stats_wake.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void wait(std::size_t count = 1) {
+        wait_until(clock::time_point::max(), count);
+    }
+
+    /// As wait, but give up once 'deadline' has passed. Return false
+    /// on timeout.
+    bool wait_until(clock::time_point deadline, std::size_t count = 1) {
+        auto v = signal_counter += count;
+        if (v <= 0)
+            return true;
+        for (unsigned i = 0; i != policy.spins; ++i) {
+            asm volatile ("pause" ::: "memory");
+            if (signal_counter.load(std::memory_order_acquire) <= 0)
+                return bump(stats_spin);
+        }
+        for (unsigned i = 0; i != policy.yields; ++i) {
+            ::sched_yield();
+            if (signal_counter.load(std::memory_order_acquire) <= 0)
+                return bump(stats_yield);
+        }
+        parked.store(true); // seq_cst, pairs with signal
+        while ((v = signal_counter.load()) > 0) {
+            if (deadline == clock::time_point::max()) {
+                signal_counter.wait(v);
+                continue;
+            }
+            auto left = deadline - clock::now();
+            if (left <= clock::duration::zero())
+                break;
+            auto sec = std::chrono::duration_cast<std::chrono::seconds>(left);
+            timespec t = { time_t(sec.count()), long((left - sec).count()) };
+            signal_counter.wait(v, t);
+        }
+        parked.store(false, std::memory_order_relaxed);
+        bump(stats_park);
+        if (v > 0) {
+            // timed out, take back the count
+            signal_counter -= count;
+            return false;
+        }
+        return true;
+    }
+
+    /// Can be called from any thread.
+    spin_stats stats() const {
+        spin_stats s;
+        s.spin  = stats_spin.load(std::memory_order_relaxed);
+        s.yield = stats_yield.load(std::memory_order_relaxed);
+        s.park  = stats_park.load(std::memory_order_relaxed);
+        s.wake  = stats_wake.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    // single writer
+    static bool bump(std::atomic<std::uint64_t>& x) {
+        x.store(x.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+        return true;
+    }
+    std::atomic<std::uint64_t> stats_spin  = { 0 };
+    std::atomic<std::uint64_t> stats_yield = { 0 };
+    std::atomic<std::uint64_t> stats_park  = { 0 };
+    std::atomic<std::uint64_t> stats_wake  = { 0 }; // any thread
+};
+
+}
+#endif
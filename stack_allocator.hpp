@@ -2,10 +2,33 @@
 #define GPD_STACK_ALLOCATOR_HPP
 #include <stdlib.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <stdint.h>
 #include <cassert>
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <map>
+#include <string>
+#include <vector>
+#include "mpsc_queue.hpp"
 
 namespace gpd {
+
+/**
+ * StackAlloc concept:
+ *
+ *   enum { stack_size = <default size> };
+ *   void * allocate(size_t size);
+ *   void deallocate(void * ptr, size_t size) throw();
+ *
+ * 'deallocate' is always passed the same size that was requested
+ * from 'allocate'. Stacks grow downward from ptr + size.
+ **/
 struct static_stack_allocator {
     enum { stack_size = 1024*1024*1024 };
     static const size_t alignment = 16;
@@ -19,12 +42,535 @@ struct static_stack_allocator {
         return result;
     }
 
-    static void deallocate(void * ptr) throw() {
+    static void deallocate(void * ptr, size_t) throw() {
         free(ptr);
     }
 
 };
 
+/**
+ * Reserve each stack as a private anonymous mapping. The mapping is
+ * created with MAP_NORESERVE, so no swap is accounted for it and the
+ * kernel commits pages only when they are first touched; the lowest
+ * page is a PROT_NONE guard, so that overflowing the stack faults
+ * instead of silently scribbling over unrelated memory.
+ *
+ * NOTE: every stack uses two VMAs, so the number of live stacks is
+ * bounded by vm.max_map_count.
+ **/
+struct mmap_stack_allocator {
+    enum { stack_size = 8*1024*1024 };
+    static const size_t alignment = 16;
+
+    static size_t page_size() {
+        static const size_t size = ::sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    static size_t round_size(size_t size) {
+        const size_t page = page_size();
+        return (size + page - 1) & ~(page - 1);
+    }
+
+    static void * allocate(size_t size = stack_size) {
+        const size_t guard = page_size();
+        const size_t length = round_size(size) + guard;
+        void * base = ::mmap(0, length, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS | 
+                             MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (base == MAP_FAILED)
+            throw std::bad_alloc();
+        if (::mprotect(base, guard, PROT_NONE) != 0) {
+            ::munmap(base, length);
+            throw std::bad_alloc();
+        }
+        return static_cast<char*>(base) + guard;
+    }
+
+    static void deallocate(void * ptr, size_t size) throw() {
+        const size_t guard = page_size();
+        int ret = ::munmap(static_cast<char*>(ptr) - guard, 
+                           round_size(size) + guard);
+        (void)ret;
+        assert(ret == 0);
+    }
+};
+
+namespace details {
+inline long sys_mbind(void * addr, unsigned long len, int mode, 
+                      const unsigned long * nodemask, unsigned long maxnode,
+                      unsigned flags) {
+    return syscall(SYS_mbind, addr, len, mode, nodemask, maxnode, flags);
+}
+
+inline long sys_get_mempolicy(int * mode, unsigned long * nodemask, 
+                              unsigned long maxnode, void * addr, 
+                              unsigned long flags) {
+    return syscall(SYS_get_mempolicy, mode, nodemask, maxnode, addr, flags);
+}
+
+enum { max_numa_nodes = 1024 };
+
+// True if this process may allocate memory from more than one node.
+inline bool numa_available() {
+    static const bool result = [] {
+        unsigned long mask[max_numa_nodes / (8 * sizeof(long))] = {};
+        if (sys_get_mempolicy(0, mask, max_numa_nodes, 0, 
+                              MPOL_F_MEMS_ALLOWED) != 0)
+            return false;
+        int nodes = 0;
+        for (auto m : mask) nodes += __builtin_popcountl(m);
+        return nodes > 1;
+    }();
+    return result;
+}
+
+inline int current_numa_node() {
+    unsigned cpu = 0, node = 0;
+    return syscall(SYS_getcpu, &cpu, &node, 0) == 0 ? int(node) : -1;
+}
+}
+
+/**
+ * Wrap StackAlloc so that the pages of a stack are preferably
+ * allocated on the NUMA node of the thread that creates it. Stacks
+ * at least HugePageThreshold bytes large are also marked eligible
+ * for transparent huge pages, trading a larger commit on first touch
+ * for fewer TLB misses on deep stacks; 0 disables huge pages.
+ *
+ * The policy is MPOL_PREFERRED, so an exhausted node falls back to
+ * remote memory instead of failing. On single node machines, or if
+ * the kernel refuses the policy, stacks are left untouched.
+ *
+ * Combined with pooled_stack_allocator, stacks released on a remote
+ * thread are queued back to the pool, and thus to the node, they
+ * came from.
+ **/
+template<class StackAlloc = mmap_stack_allocator, 
+         size_t HugePageThreshold = 0>
+struct numa_stack_allocator {
+    enum { stack_size = StackAlloc::stack_size };
+    static const size_t alignment = StackAlloc::alignment;
+
+    static void * allocate(size_t size = stack_size) {
+        void * ptr = StackAlloc::allocate(size);
+        advise(ptr, size);
+        return ptr;
+    }
+
+    static void deallocate(void * ptr, size_t size) throw() {
+        StackAlloc::deallocate(ptr, size);
+    }
+
+private:
+    static void advise(void * ptr, size_t size) {
+        // both mbind and madvise want page aligned ranges
+        const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1) & 
+            ~(page - 1);
+        uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + size) & 
+            ~(page - 1);
+        if (end <= begin)
+            return;
+        void * addr = reinterpret_cast<void*>(begin);
+        if (details::numa_available()) {
+            int node = details::current_numa_node();
+            if (node >= 0 && node < details::max_numa_nodes) {
+                unsigned long mask[details::max_numa_nodes / 
+                                   (8 * sizeof(long))] = {};
+                mask[node / (8 * sizeof(long))] = 
+                    1ul << (node % (8 * sizeof(long)));
+                details::sys_mbind(addr, end - begin, MPOL_PREFERRED, 
+                                   mask, details::max_numa_nodes, 0);
+            }
+        }
+        if (HugePageThreshold && size >= HugePageThreshold)
+            ::madvise(addr, end - begin, MADV_HUGEPAGE);
+    }
+};
+
+/// Reclaim policies for pooled_stack_allocator. 'reclaim' is invoked
+/// with the whole [ptr, ptr + size) range of a stack whenever it is
+/// put back into a pool.
+struct no_reclaim {
+    static void reclaim(void *, size_t) throw() {}
+};
+
+/**
+ * Keep at most ResidentBudget bytes at the top of a cached stack
+ * resident and give back anything below to the kernel with
+ * madvise(Advice). MADV_FREE is cheaper than MADV_DONTNEED, as pages
+ * are only dropped under memory pressure, but needs Linux 4.5.
+ *
+ * A watermark word is left at the bottom of the budget, so that it
+ * stays on a resident page; the madvise call is skipped while the
+ * watermark is intact, i.e. as long as no user of the stack reached
+ * the depth of the budget. A frame that spans the watermark without
+ * writing to it goes undetected, which only delays reclamation until
+ * the stack is dirtied again.
+ *
+ * Only whole pages inside the stack are released, so a StackAlloc
+ * that is not page aligned (like static_stack_allocator) is safe,
+ * if less effective; mmap backed ones (like mmap_stack_allocator)
+ * are the intended use.
+ **/
+template<size_t ResidentBudget = 64*1024, int Advice = MADV_DONTNEED>
+struct madvise_reclaim {
+    static const uintptr_t watermark = 0x6770645f6d61726bULL;
+
+    static void reclaim(void * ptr, size_t size) throw() {
+        const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1) &
+            ~(page - 1);
+        uintptr_t limit = reinterpret_cast<uintptr_t>(ptr) + size - 
+            ResidentBudget;
+        limit &= ~(page - 1);
+        if (size <= ResidentBudget || limit <= begin)
+            return;
+        uintptr_t * mark = reinterpret_cast<uintptr_t*>(limit);
+        if (*mark == watermark)
+            return;
+        ::madvise(reinterpret_cast<void*>(begin), limit - begin, Advice);
+        *mark = watermark;
+    }
+};
+
+namespace details {
+
+// Lives in the last bytes of every pooled block, just above the top
+// of the stack handed out from it.
+struct alignas(16) stack_header : node {
+    void * owner;
+};
+
+/**
+ * Per-thread cache of stacks of StackAlloc, bucketed by power of two
+ * size classes. Only the owning thread touches the free lists; other
+ * threads hand stacks back through the 'remote' queue, which is
+ * drained by the owner when a free list runs dry.
+ *
+ * Each block is exactly class_size bytes, so that page aligned
+ * allocators do not pay for an extra page; the header takes its
+ * last sizeof(stack_header) bytes and a stack of 'size' bytes is
+ * [header - size, header).
+ *
+ * The pool is reference counted by its thread and by every stack
+ * currently in use, so that it outlives its thread as long as stacks
+ * allocated from it are still running somewhere else.
+ **/
+template<class StackAlloc, size_t Capacity, class Reclaim>
+struct stack_pool {
+    enum { min_shift = 12, class_count = 20 };
+    static_assert(StackAlloc::alignment % alignof(stack_header) == 0,
+                  "StackAlloc does not align the pooled stack headers");
+
+    struct stats_t {
+        size_t hits;
+        size_t misses;
+        size_t remote_frees;
+        size_t high_water;
+    };
+
+    static size_t class_of(size_t size) {
+        size_t cls = 0;
+        while (usable_size(cls) < size) ++cls;
+        return cls;
+    }
+
+    static size_t class_size(size_t cls) {
+        return size_t(1) << (cls + min_shift);
+    }
+
+    static size_t usable_size(size_t cls) {
+        return class_size(cls) - sizeof(stack_header);
+    }
+
+    // The header of the stack [ptr, ptr + size).
+    static stack_header * header(void * ptr, size_t size) {
+        return reinterpret_cast<stack_header*>
+            (static_cast<char*>(ptr) + size);
+    }
+
+    static stack_header * block_header(void * block, size_t cls) {
+        return header(block, usable_size(cls));
+    }
+
+    static void * block(stack_header * h, size_t cls) {
+        return reinterpret_cast<char*>(h) - usable_size(cls);
+    }
+
+    static void release(stack_header * h, size_t cls) throw() {
+        StackAlloc::deallocate(block(h, cls), class_size(cls));
+    }
+
+    void * allocate(size_t cls, size_t size) {
+        stack_header * h = free[cls];
+        if (!h) {
+            drain();
+            h = free[cls];
+        }
+        if (h) {
+            free[cls] = static_cast<stack_header*>
+                (h->m_next.load(std::memory_order_relaxed));
+            --count[cls];
+            ++stats.hits;
+        } else {
+            h = block_header(StackAlloc::allocate(class_size(cls)), cls);
+            h->owner = this;
+            ++stats.misses;
+        }
+        size_t in_use = refs.fetch_add(1, std::memory_order_relaxed);
+        stats.high_water = std::max(stats.high_water, in_use);
+        return reinterpret_cast<char*>(h) - size;
+    }
+
+    void deallocate(stack_header * h, size_t cls) throw() {
+        assert(h->owner == this);
+        cache(h, cls);
+        put();
+    }
+
+    void remote_deallocate(stack_header * h, size_t cls) throw() {
+        h->m_next.store(nullptr, std::memory_order_relaxed);
+        // stash the class in the owner field until the owner drains
+        // the queue
+        h->owner = reinterpret_cast<void*>(cls);
+        remote.push(h);
+        put();
+    }
+
+    void cache(stack_header * h, size_t cls) throw() {
+        if (count[cls] == Capacity) {
+            release(h, cls);
+            return;
+        }
+        Reclaim::reclaim(block(h, cls), usable_size(cls));
+        h->owner = this;
+        h->m_next.store(free[cls], std::memory_order_relaxed);
+        free[cls] = h;
+        ++count[cls];
+    }
+
+    void drain() throw() {
+        while (auto h = remote.pop()) {
+            ++stats.remote_frees;
+            cache(h, reinterpret_cast<size_t>(h->owner));
+        }
+    }
+
+    void put() throw() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) 
+            destroy();
+    }
+
+    // Called by whoever drops the last reference. The owning thread
+    // has already left, so it is safe to consume the queue here.
+    void destroy() throw() {
+        while (auto h = remote.pop()) 
+            release(h, reinterpret_cast<size_t>(h->owner));
+        for (size_t cls = 0; cls != class_count; ++cls)
+            while (auto h = free[cls]) {
+                free[cls] = static_cast<stack_header*>
+                    (h->m_next.load(std::memory_order_relaxed));
+                release(h, cls);
+            }
+        delete this;
+    }
+
+    // The calling thread's pool, or null if the thread has not
+    // prepared one yet or has already released it. Both are plain
+    // thread locals, readable at any point of the thread's exit.
+    static stack_pool *& current() {
+        static thread_local stack_pool * pool = 0;
+        return pool;
+    }
+
+    static bool& exited() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    struct holder {
+        holder() { current() = new stack_pool; }
+        ~holder() {
+            auto pool = current();
+            current() = 0;
+            exited() = true;
+            pool->put();
+        }
+    };
+
+    // Create the calling thread's pool, unless it already left.
+    static stack_pool * prepare() {
+        if (!current() && !exited()) {
+            static thread_local holder h;
+            (void)h;
+        }
+        return current();
+    }
+
+    stack_header * free[class_count] = {};
+    size_t count[class_count] = {};
+    stats_t stats = {};
+    std::atomic<size_t> refs = { 1 };
+    mpsc_queue<stack_header> remote;
+};
+}
+
+/**
+ * Recycle stacks of the underlying StackAlloc through a per-thread
+ * cache holding at most Capacity stacks per size class, so that
+ * short lived continuations do not pay for a full allocate/free
+ * round trip. Requested sizes plus a 16 byte header are rounded up
+ * to a power of two, so a request of exactly 2^n bytes takes the
+ * next class; the untouched part of a block only costs address
+ * space. Sizes above the largest class are forwarded to StackAlloc.
+ *
+ * A stack released on a thread other than the one that allocated it
+ * is queued back to its original pool. Stacks allocated while the
+ * thread is exiting, after its pool was released, bypass the cache. Before a stack is cached, the
+ * Reclaim policy may release its deeper pages (see madvise_reclaim).
+ **/
+template<class StackAlloc = mmap_stack_allocator, size_t Capacity = 64,
+         class Reclaim = no_reclaim>
+struct pooled_stack_allocator {
+    enum { stack_size = StackAlloc::stack_size };
+    static const size_t alignment = StackAlloc::alignment;
+
+    typedef details::stack_pool<StackAlloc, Capacity, Reclaim> pool;
+    typedef typename pool::stats_t stats_t;
+
+    static void * allocate(size_t size = stack_size) {
+        size_t cls = pool::class_of(size);
+        if (cls >= pool::class_count)
+            return StackAlloc::allocate(size);
+        if (auto local = pool::prepare())
+            return local->allocate(cls, size);
+        // the thread is exiting: an unpooled stack
+        auto h = pool::block_header
+            (StackAlloc::allocate(pool::class_size(cls)), cls);
+        h->owner = 0;
+        return reinterpret_cast<char*>(h) - size;
+    }
+
+    /// Never creates a pool; stacks are handed back to the pool they
+    /// came from, or to StackAlloc once that is gone.
+    static void deallocate(void * ptr, size_t size) throw() {
+        size_t cls = pool::class_of(size);
+        if (cls >= pool::class_count)
+            return StackAlloc::deallocate(ptr, size);
+        auto h = pool::header(ptr, size);
+        auto owner = static_cast<pool*>(h->owner);
+        if (!owner)
+            pool::release(h, cls);
+        else if (owner == pool::current())
+            owner->deallocate(h, cls);
+        else
+            owner->remote_deallocate(h, cls);
+    }
+
+    /// Create the calling thread's pool ahead of its first
+    /// allocation, e.g. when the thread starts; otherwise that
+    /// allocation does.
+    static void prepare_thread() { pool::prepare(); }
+
+    /// Statistics of the calling thread's pool. 'high_water' is the
+    /// largest number of stacks from this pool in use at once.
+    static stats_t stats() {
+        auto local = pool::prepare();
+        return local ? local->stats : stats_t();
+    }
+};
+
+/// Stack usage recorded by profiling_stack_allocator for one site.
+struct stack_usage {
+    std::string site;
+    size_t stacks = 0;     // number of stacks released
+    size_t max_depth = 0;  // deepest use seen, in bytes
+    // histogram[i] counts stacks whose depth d is in [2^(i-1), 2^i)
+    size_t histogram[64] = {};
+};
+
+namespace details {
+struct stack_usage_registry {
+    std::mutex mutex;
+    std::map<std::string, stack_usage> sites;
+
+    void record(const char * site, size_t depth) {
+        std::lock_guard<std::mutex> _ (mutex);
+        auto& usage = sites[site];
+        usage.site = site;
+        usage.stacks++;
+        usage.max_depth = std::max(usage.max_depth, depth);
+        usage.histogram[depth ? std::min(64 - __builtin_clzl(depth), 63) : 0]++;
+    }
+
+    static stack_usage_registry& get() {
+        static stack_usage_registry registry;
+        return registry;
+    }
+};
+}
+
+/// Snapshot of the stack usage recorded so far, one entry per site.
+inline std::vector<stack_usage> stack_usage_report() {
+    auto& registry = details::stack_usage_registry::get();
+    std::lock_guard<std::mutex> _ (registry.mutex);
+    std::vector<stack_usage> result;
+    for (auto& x : registry.sites)
+        result.push_back(x.second);
+    return result;
+}
+
+inline void reset_stack_usage() {
+    auto& registry = details::stack_usage_registry::get();
+    std::lock_guard<std::mutex> _ (registry.mutex);
+    registry.sites.clear();
+}
+
+/**
+ * Profiling wrapper around StackAlloc. Stacks are painted with a
+ * canary pattern when allocated; when they are released the deepest
+ * overwritten word gives the maximum depth the continuation actually
+ * used, which is recorded under the 'site' name passed at
+ * construction and can be retrieved with stack_usage_report():
+ *
+ *   callcc(stack_hint(64*1024, profiling_stack_allocator<>("parser")), f);
+ *
+ * Painting commits the whole stack, so this is meant for sizing
+ * stacks during testing, not for production use.
+ **/
+template<class StackAlloc = mmap_stack_allocator>
+struct profiling_stack_allocator {
+    enum { stack_size = StackAlloc::stack_size };
+    static const size_t alignment = StackAlloc::alignment;
+    static const uint64_t canary = 0x5354414b43414e59ULL;
+
+    explicit profiling_stack_allocator(const char * site = "unknown") 
+        : site(site) {}
+
+    void * allocate(size_t size = stack_size) {
+        void * ptr = StackAlloc::allocate(size);
+        std::fill_n(static_cast<uint64_t*>(ptr), size / sizeof(uint64_t),
+                    uint64_t(canary));
+        return ptr;
+    }
+
+    void deallocate(void * ptr, size_t size) throw() {
+        auto begin = static_cast<uint64_t*>(ptr);
+        auto end = begin + size / sizeof(uint64_t);
+        auto used = std::find_if(begin, end, 
+                                 [](uint64_t x) { return x != canary; });
+        try {
+            details::stack_usage_registry::get()
+                .record(site, (end - used) * sizeof(uint64_t));
+        } catch(...) {}
+        StackAlloc::deallocate(ptr, size);
+    }
+
+    const char * site;
+};
+
 struct debug_stack_allocator {
     static const size_t alignment = 16;
     enum { stack_size = static_stack_allocator::stack_size };
@@ -34,9 +580,9 @@ struct debug_stack_allocator {
         return ret;
     }
 
-    void deallocate(void * ptr) throw() {
+    void deallocate(void * ptr, size_t size) throw() {
         count--;
-        return static_stack_allocator::deallocate(ptr);
+        return static_stack_allocator::deallocate(ptr, size);
     }
 
     debug_stack_allocator(debug_stack_allocator&) = delete;
@@ -1,13 +1,38 @@
 #include "task.hpp"
 #include "mpsc_queue.hpp"
-#include "fd_waiter.hpp"
+#include "ready_queue.hpp"
+#include "spin_waiter.hpp"
+#include "ws_deque.hpp"
+#include "epoll_reactor.hpp"
+#include "uring.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <climits>
+#include <fstream>
 #include <mutex>
 #include <set>
+#include <string>
+#include <system_error>
+#include <vector>
 namespace gpd {
 namespace {
 
 thread_local scheduler * scheduler_ptr = 0;
 
+// Written by the owner thread only, readable from any thread: a
+// relaxed load and store, no read-modify-write.
+struct counter {
+    std::atomic<std::uint64_t> value = { 0 };
+    void add(std::uint64_t x = 1) {
+        value.store(value.load(std::memory_order_relaxed) + x,
+                    std::memory_order_relaxed);
+    }
+    std::uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
 struct scheduler_saver {
     scheduler * saved;
     scheduler_saver(scheduler& sched)
@@ -19,66 +44,624 @@ struct scheduler_saver {
 }
 
 
+namespace {
+// A sysfs cpu list, e.g. "0-3,8,10-11"
+std::vector<int> read_cpu_list(const std::string& path) {
+    std::vector<int> cpus;
+    std::ifstream in(path);
+    int first, last;
+    while (in >> first) {
+        last = first;
+        if (in.peek() == '-')
+            in.ignore() >> last;
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+        if (in.peek() == ',')
+            in.ignore();
+    }
+    return cpus;
+}
+
+// Set the affinity of the calling thread as per 'where' and return 0
+// or an error number. 'cpus' is set to the cpus bound to, none for
+// the default placement.
+int bind_thread(const placement& where, std::vector<int>& cpus) {
+    cpus.clear();
+    if (where.cpus.empty() && where.numa_node == -1)
+        return 0;
+    auto allowed = where.cpus.empty() ? online_cpus() : where.cpus;
+    std::sort(allowed.begin(), allowed.end());
+    allowed.erase(std::unique(allowed.begin(), allowed.end()), allowed.end());
+    if (where.numa_node != -1) {
+        auto node = online_cpus(where.numa_node);
+        std::set_intersection(allowed.begin(), allowed.end(),
+                              node.begin(), node.end(),
+                              std::back_inserter(cpus));
+    } else
+        cpus = std::move(allowed);
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return EINVAL;
+        CPU_SET(cpu, &set);
+    }
+    if (cpus.empty())
+        return EINVAL;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+}
+
+struct scheduler_pool::state {
+    state(std::size_t size) : schedulers(size) {}
+    std::vector<std::unique_ptr<scheduler> > schedulers;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> next = { 0 };
+    std::atomic<int> parked = { 0 };
+    std::atomic<bool> stopping = { false };
+
+    void stop();
+    void wake_one(scheduler* self);
+    details::scheduler_node* steal(scheduler* self);
+};
+
 struct scheduler {
     scheduler(const scheduler&) = delete;
-    scheduler() {}
+    explicit scheduler(idle_policy policy = {}) : waiter(policy) {}
+    ~scheduler() { delete io.load(); delete ring.load(); }
     friend void idle(scheduler&);
+    friend idle_stats get_idle_stats(scheduler&);
+    friend scheduler_stats get_stats(scheduler&);
+    friend std::vector<int> get_cpus(scheduler&);
+    friend void set_run_next(scheduler&, unsigned);
+    friend void set_tenant_weight(scheduler&, unsigned, unsigned);
+    friend void set_task_class(task_class);
+    friend task_class get_task_class();
+    friend struct details::scheduler_node;
+    friend void details::start_task(details::task_job&);
+    friend struct scheduler_pool::state;
+    friend struct scheduler_pool;
     typedef details::scheduler_node node;
 
     node* pop() {
-        std::uint64_t pri[] = {
-            get_pri(pinned_tasks),
-            get_pri(tasks),
-            get_pri(remote_tasks)};
-        return
-            pri[0] <=  pri[1] && pri[0] <= pri[2] ?
-            pinned_tasks.pop_unlocked() :
-            pri[1] <= pri[2] ?
-            tasks.pop_unlocked() :
-            remote_tasks.pop();
+        end_slice();
+        drain_remote();
+        if (run_next) {
+            // the slot does not jump ahead of a higher class
+            if (run_next_streak < run_next_limit.load(std::memory_order_relaxed) &&
+                unsigned(run_next->cls) <= ready.top()) {
+                ++run_next_streak;
+                return counted(std::exchange(run_next, nullptr));
+            }
+            // let the queues have a turn: a ping-pong pair could
+            // keep the slot for ever
+            push(std::exchange(run_next, nullptr));
+        }
+        run_next_streak = 0;
+        if (!pool)
+            return ready.empty() ? 0 : pop_ready(ready.top());
+        for (unsigned c = 0; c < task_class_count; ++c) {
+            auto& deque = deques[c];
+            if (!ready.empty(c)) {
+                // alternate between the deque and the ready queue,
+                // so that neither can starve the other
+                node * n = (deque_first = !deque_first) && !deque.empty() ?
+                    deque.pop() : 0;
+                return n ? counted(n) : pop_ready(c);
+            }
+            // newest first, without a CAS unless racing a thief for
+            // the last one
+            if (!deque.empty())
+                if (node * n = deque.pop())
+                    return counted(n);
+        }
+        node * n = pool->steal(this);
+        if (n) counters.steals.add();
+        return n;
+    }
+
+    void add_timer(timer* t) {
+        // run_timers() leaves an empty wheel alone: catch up first, or
+        // the timer would be placed against a stale tick
+        if (timers.empty())
+            timers.advance(timer::clock::now(), [](timer_wheel::node*) {});
+        timers.add(t, t->deadline_);
+    }
+
+    void cancel_timer(timer* t) {
+        if (t->linked()) {
+            timers.remove(t);
+            unlinked(t);
+        }
+    }
+
+    // Every timer leaving the wheel goes through here.
+    void unlinked(timer* t) {
+        if (t->background)
+            --background_timers;
+    }
+
+    // Hide a freshly armed timer from a draining scheduler.
+    static void set_background(timer& t) {
+        t.background = true;
+        ++t.sched->background_timers;
+    }
+
+    // created on first use
+    epoll_reactor& reactor() {
+        auto r = io.load(std::memory_order_relaxed);
+        if (!r) {
+            r = new epoll_reactor;
+            io.store(r, std::memory_order_release);
+        }
+        return *r;
+    }
+
+    // created on first use; null if io_uring is not available
+    uring* io_ring() {
+        auto r = ring.load(std::memory_order_relaxed);
+        if (!r) {
+            r = new uring;
+            ring.store(r, std::memory_order_release);
+        }
+        return r->valid() ? r : 0;
+    }
+
+    void poll_io() {
+        auto r = io.load(std::memory_order_relaxed);
+        if (r && r->size())
+            r->poll();
+        auto u = ring.load(std::memory_order_relaxed);
+        if (u && u->outstanding()) {
+            u->submit();
+            u->reap(complete);
+        }
+    }
+
+    static void complete(io_uring_cqe const& cqe);
+
+    void run_timers() {
+        if (!timers.empty())
+            timers.advance(timer::clock::now(), [this](timer_wheel::node* n) {
+                    auto t = static_cast<timer*>(n);
+                    unlinked(t);
+                    t->ev.signal();
+                });
     }
 
     void push(node* n) {
-        int pri = generation.load(std::memory_order_relaxed) + 1;
-        n->pri = pri;
         if (scheduler_ptr == this) {
-            generation.store(pri,std::memory_order_relaxed);                
-            (pinned ? pinned_tasks : tasks).push_unlocked(n);
+            if (pool && !n->pinned) {
+                deques[unsigned(n->cls)].push(n);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (pool->parked.load(std::memory_order_relaxed))
+                    pool->wake_one(this);
+            } else
+                push_ready(n);
         } else {
+            remote_pushes.fetch_add(1, std::memory_order_relaxed);
             remote_tasks.push(n); // seq_cst
-            if (waiting)
-                waiter.signal({});
+            wake_waiting();
         }
     }
+
+    // As push(), but a task of this scheduler goes to the back of
+    // the ready queue rather than on a deque, which pop() takes
+    // newest first: a task yielding there would run again straight
+    // away, ahead of the others.
+    void push_back(node* n) {
+        if (scheduler_ptr == this)
+            push_ready(n);
+        else
+            push(n);
+    }
+
+    // Make 'n', woken up by a task of this scheduler, the next to
+    // run; the task in the slot, if any, goes to the back of the
+    // queue.
+    void push_next(node* n) {
+        assert(scheduler_ptr == this);
+        if (!run_next_limit.load(std::memory_order_relaxed))
+            return push(n);
+        if (auto prev = std::exchange(run_next, n))
+            push(prev);
+    }
+
+    // Push the chain [first, last], linked through m_next, as many
+    // push() calls would, but with a single exchange on the remote
+    // queue and at most one wake up.
+    void post_many(node* first, node* last) {
+        if (scheduler_ptr == this) {
+            bool shared = false;
+            for (node * n = first, * next; n; n = next) {
+                next = n == last ? 0 :
+                    static_cast<node*>(n->m_next.load(std::memory_order_relaxed));
+                if (pool && !n->pinned) {
+                    deques[unsigned(n->cls)].push(n);
+                    shared = true;
+                } else
+                    push_ready(n);
+            }
+            if (shared) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (pool->parked.load(std::memory_order_relaxed))
+                    pool->wake_one(this);
+            }
+        } else {
+            std::uint64_t count = 1;
+            for (node * n = first; n != last;
+                 n = static_cast<node*>(n->m_next.load(std::memory_order_relaxed)))
+                ++count;
+            remote_pushes.fetch_add(count, std::memory_order_relaxed);
+            remote_tasks.push_batch(first, last); // seq_cst
+            wake_waiting();
+        }
+    }
+
+    // any thread
+    // Wake the scheduler up if it is parked; return true if this call
+    // did. Concurrent callers collapse into a single wake(), by
+    // whoever claims 'waiting' first. park() sets it again before
+    // every wait, after resetting the waiter.
+    bool wake_waiting() {
+        // the push published the node with a release store: without
+        // a full fence, the load below could be satisfied before it
+        // is visible. Pairs with the fence in park() between setting
+        // 'waiting' and looking at the remote queue: either the
+        // scheduler sees the node or we see it waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load() && waiting.exchange(false)) {
+            wake();
+            return true;
+        }
+        return false;
+    }
+
+    // any thread
+    void wake() {
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+        waiter.signal({});
+        int writes = 0;
+        if (auto r = io.load(std::memory_order_acquire))
+            writes += r->notify();
+        if (auto u = ring.load(std::memory_order_acquire))
+            writes += u->notify();
+        if (writes)
+            eventfd_writes.fetch_add(writes, std::memory_order_relaxed);
+    }
     
+    enum run_state_t { running, draining, stopped };
+
+    // any thread
+    void request_stop(run_state_t to) {
+        int old = run_state.load();
+        while (old < to && !run_state.compare_exchange_weak(old, to))
+            ;
+        wake();
+    }
+
+    // Stopped, or drained: draining with only the ready queues left
+    // to run.
+    bool stop_requested() const {
+        auto state = run_state.load(std::memory_order_relaxed);
+        return state == stopped || (pool && pool->stopping) ||
+            (state == draining && !waits_pending());
+    }
+
+    // Timers armed, descriptors or io_uring operations waited for: a
+    // draining scheduler sees them through, background sleeps aside.
+    bool waits_pending() const {
+        auto r = io.load(std::memory_order_relaxed);
+        auto u = ring.load(std::memory_order_relaxed);
+        return timers.size() > background_timers || (r && r->size()) ||
+            (u && u->outstanding());
+    }
+
+    // The body of a background thread: bind it, publish a new
+    // scheduler through 'result', run it until stopped and unwind the
+    // tasks left. The scheduler is deleted by whoever stopped it.
+    static void run_thread(const placement& where, idle_policy policy,
+                           promise<scheduler*>& result) {
+        std::vector<int> cpus;
+        if (int error = bind_thread(where, cpus)) {
+            result.set_exception(std::system_error
+                                 (error, std::system_category(),
+                                  "scheduler affinity"));
+            return;
+        }
+        auto sched = new scheduler(policy);
+        sched->cpus = std::move(cpus);
+        result.set_value(sched);
+        while (sched->run_state.load(std::memory_order_relaxed) != stopped)
+            idle(*sched);
+        sched->shutdown();
+    }
+
+    // Unwind the tasks left once stopped: those queued and, woken up
+    // for that, those waiting for the timers, descriptors and io_uring
+    // operations of the scheduler. Destroying their continuation
+    // resumes them with an exit_exception.
+    void shutdown() {
+        scheduler_saver _ (*this);
+        while (spare_count)
+            task_t unwind = std::move(spares[--spare_count].context);
+        auto deadline = timer::clock::time_point::max();
+        while (true) {
+            timers.clear([this](timer_wheel::node* n) {
+                    auto t = static_cast<timer*>(n);
+                    unlinked(t);
+                    t->ev.signal();
+                });
+            if (auto r = io.load(std::memory_order_relaxed))
+                r->signal_all();
+            if (node * n = pop()) {
+                task_t unwind = std::move(n->task);
+                continue;
+            }
+            // the kernel writes into the operations in flight until
+            // they complete: if they cannot be cancelled in time,
+            // their tasks are left suspended and their stacks leaked
+            auto u = ring.load(std::memory_order_relaxed);
+            if (!u || !u->valid() || !u->outstanding())
+                break;
+            if (deadline == timer::clock::time_point::max()) {
+                if (!u->cancel_all())
+                    break;
+                deadline = timer::clock::now() + std::chrono::seconds(1);
+            } else if (timer::clock::now() > deadline)
+                break;
+            u->wait(deadline, [] { return true; });
+            u->reap(complete);
+        }
+    }
+
     bool pinned = false;
+    // of the running task
+    task_class cls = task_class::normal;
+    unsigned char tenant = 0;
+    cancellation_token* token = 0;
 private:
+    // The idle context: never stolen, nor picked from the deques,
+    // nor counted as a task.
+    void push_pinned(node* n) {
+        idle_node = n;
+        ready.push(n, unsigned(n->cls), n->tenant);
+    }
 
-    static std::uint64_t get_pri(mpsc_queue<node>& q) {
-        node * n = static_cast<node*>(q.peek());
-        return n ? n->pri : std::uint64_t(-1);
+    void push_ready(node* n) {
+        ready.push(n, unsigned(n->cls), n->tenant);
+        (n->pinned ? counters.pinned_queued : counters.tasks_queued).add();
     }
-    
-    std::atomic<std::uint64_t> generation;
-    mpsc_queue<node> pinned_tasks;
-    mpsc_queue<node> tasks;
+
+    node* pop_ready(unsigned c) {
+        bool shared = ready.shared(c);
+        node * n = ready.pop(c);
+        if (n != idle_node) {
+            (n->pinned ? counters.pinned_queued : counters.tasks_queued)
+                .add(-1);
+            if (shared)
+                slice = { true, c, n->tenant, timer::clock::now() };
+        }
+        return counted(n);
+    }
+
+    // Charge the tenant of the task popped from a class shared with
+    // other tenants for its run time, now that it has suspended: one
+    // more turn per tenant_quantum.
+    void end_slice() {
+        if (!slice.open)
+            return;
+        slice.open = false;
+        auto ran = timer::clock::now() - slice.start;
+        if (auto cost = ran / std::chrono::microseconds(tenant_quantum))
+            ready.charge(slice.cls, slice.tenant, cost);
+    }
+
+    node* counted(node* n) {
+        if (n != idle_node)
+            (n->pinned ? counters.pinned_pops : counters.local_pops).add();
+        return n;
+    }
+
+    // Move the remote arrivals to the ready queue, in one go; pop()
+    // then only looks at local queues. A producer preempted mid-push
+    // can hide the rest of the queue until the next drain.
+    void drain_remote() {
+        if (remote_tasks.empty())
+            return;
+        std::uint64_t drained = 0;
+        while (drained < remote_drain_limit)
+            if (node * n = remote_tasks.pop()) {
+                push_ready(n);
+                ++drained;
+            } else
+                break;
+        counters.remote_pops.add(drained);
+    }
+
+    // The body of a context started by start_task: run jobs, parking
+    // the context in the spares of the scheduler each one finishes
+    // on, for as long as there is room.
+    static task_t run_jobs(details::task_job * job, task_t caller) {
+        while (true) {
+            job->run(job, std::move(caller));
+            auto& sched = details::scheduler_get_local();
+            if (sched.spare_count == spare_limit || sched.stop_requested())
+                return details::scheduler_pop();
+            caller = callcc(
+                details::scheduler_pop(),
+                [&](task_t self) {
+                    sched.spares[sched.spare_count++] = { std::move(self), &job };
+                    return self;
+                });
+        }
+    }
+
+    // bounds the time spent draining a flooded queue
+    static const unsigned remote_drain_limit = 256;
+
+    // Block until a task is available. Return null if the next timer
+    // is due or the pool is stopping.
+    node* park() {
+        node * next;
+        while (true) {
+            // reset first: a waker might claim 'waiting' as soon as
+            // it is set. Set it again on every round, as the wake up
+            // that claimed it might have been for a push not visible
+            // to pop() yet (a producer preempted mid-push)
+            waiter.reset();
+            waiting.exchange(true);
+            // before pop() looks at the remote queue, see
+            // wake_waiting()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (pool) pool->parked++;
+            next = pop();
+            bool woken = true;
+            if (!next && !stop_requested()) {
+                auto start = timer::clock::now();
+                woken = wait(timers.next_deadline());
+                counters.parks.add();
+                counters.parked_ns.add
+                    (std::chrono::duration_cast<std::chrono::nanoseconds>
+                     (timer::clock::now() - start).count());
+            }
+            if (pool) pool->parked--;
+            waiting.store(0, std::memory_order_relaxed);
+            if (next || !woken || stop_requested())
+                return next;
+        }
+    }
+
+    // Wait for a wake(), in epoll if descriptors are waited for, or
+    // until 'deadline'. Return false on timeout.
+    bool wait(timer::clock::time_point deadline) {
+        auto r = io.load(std::memory_order_relaxed);
+        auto u = ring.load(std::memory_order_relaxed);
+        if (u && u->outstanding()) {
+            // in io_uring, with the reactor polled through it
+            if ((waiter.signal_counter += 1) <= 0)
+                return true;
+            u->wait(deadline,
+                    [&] { return waiter.signal_counter.load() > 0; },
+                    r && r->size() ? r->native_handle() : -1);
+            if (waiter.signal_counter.load() > 0)
+                waiter.signal_counter -= 1; // not consumed by a wake()
+            poll_io();
+            return deadline == timer::clock::time_point::max() ||
+                timer::clock::now() < deadline;
+        }
+        if (!r || !r->size())
+            return waiter.wait_until(deadline);
+        if ((waiter.signal_counter += 1) <= 0)
+            return true;
+        int timeout = -1;
+        if (deadline != timer::clock::time_point::max()) {
+            auto left = deadline - timer::clock::now();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>
+                (left + std::chrono::milliseconds(1) - 
+                 timer::clock::duration(1)).count();
+            timeout = ms <= 0 ? 0 : ms > INT_MAX ? INT_MAX : int(ms);
+        }
+        r->poll(timeout, [&] { return waiter.signal_counter.load() > 0; });
+        if (waiter.signal_counter.load() > 0)
+            waiter.signal_counter -= 1; // not consumed by a wake()
+        return timeout == -1 || timer::clock::now() < deadline;
+    }
+
+    // Owner thread counters, see get_stats.
+    struct {
+        counter pinned_pops, local_pops, remote_pops, steals;
+        counter pinned_queued, tasks_queued;
+        counter idle_entries, parks, parked_ns;
+    } counters;
+
+    // LIFO slot, ahead of the queues; never stolen
+    node * run_next = 0;
+    unsigned run_next_streak = 0;
+    std::atomic<unsigned> run_next_limit = { 0 };
+
+    ready_queue<node, task_class_count, tenant_count> ready;
+    // run time worth a turn, in microseconds
+    static const unsigned tenant_quantum = 50;
+    struct {
+        bool open;
+        unsigned cls;
+        unsigned tenant;
+        timer::clock::time_point start;
+    } slice = {};
+    node * idle_node = 0;
     mpsc_queue<node> remote_tasks;
 
-    std::atomic<bool> waiting;
-    fd_waiter waiter;
+    std::atomic<bool> waiting = { false };
+    spin_waiter waiter;
+    timer_wheel timers;
+    // armed by background_sleep_until
+    std::size_t background_timers = 0;
+    std::atomic<epoll_reactor*> io = { 0 };
+    std::atomic<uring*> ring = { 0 };
+
+    // Contexts of finished tasks, and where each expects its next
+    // job, for start_task.
+    struct spare {
+        task_t context;
+        details::task_job ** job;
+    };
+    static const std::size_t spare_limit = 64;
+    spare spares[spare_limit];
+    std::size_t spare_count = 0;
+
+    scheduler_pool::state * pool = 0;
+    std::size_t index = 0;
+    std::vector<int> cpus; // bound to, if any
+    bool deque_first = false;
+    ws_deque<node> deques[task_class_count];
+
+    // written by other threads
+    padding_t _;
+    std::atomic<std::uint64_t> remote_pushes = { 0 };
+    std::atomic<std::uint64_t> wakeups = { 0 };
+    std::atomic<std::uint64_t> eventfd_writes = { 0 };
+    std::atomic<int> run_state = { running };
 };
 
+void scheduler_pool::state::wake_one(scheduler* self) {
+    for (auto& s : schedulers)
+        if (s.get() != self && s->wake_waiting())
+            return;
+}
+
+details::scheduler_node* scheduler_pool::state::steal(scheduler* self) {
+    auto size = schedulers.size();
+    // higher classes first
+    for (unsigned c = 0; c < task_class_count; ++c)
+        for (std::size_t i = 1; i < size; ++i) {
+            auto& deque = schedulers[(self->index + i) % size]->deques[c];
+            if (!deque.empty())
+                if (auto n = deque.steal())
+                    return n;
+        }
+    return 0;
+}
 
 namespace details {
 
 scheduler_node::scheduler_node()
-    : pri(0)
-    , sched(scheduler_ptr)
+    : sched(scheduler_ptr)
     , pinned(sched && sched->pinned)
+    , cls(sched ? sched->cls : task_class::normal)
+    , tenant(sched ? sched->tenant : 0)
+    , token(sched ? sched->token : 0)
 {}
 
 scheduler_node::~scheduler_node() {
     if(sched) std::exchange(sched->pinned, pinned);
+    // resumed: the running task is this one
+    if (scheduler_ptr) {
+        scheduler_ptr->cls = cls;
+        scheduler_ptr->tenant = tenant;
+        scheduler_ptr->token = token;
+    }
 }
 
 bool scheduler_node::stolen() const {
@@ -96,7 +679,7 @@ void scheduler_post(details::scheduler_node& n) {
     if ( (n.pinned && n.stolen()) || !scheduler_ptr)
         n.sched->push(&n);
     else
-        scheduler_ptr->push(&n);
+        scheduler_ptr->push_next(&n);
 }
 
 task_t scheduler_pop() {
@@ -105,46 +688,435 @@ task_t scheduler_pop() {
     return std::move(next->task);
 }
 
+void start_task(task_job& job) {
+    auto * sched = scheduler_ptr;
+    if (sched && sched->spare_count) {
+        auto& s = sched->spares[--sched->spare_count];
+        *s.job = &job;
+        task_t c = std::move(s.context);
+        c();
+        assert(!c);
+    } else {
+        auto c = callcc([&job](task_t caller) {
+                return scheduler::run_jobs(&job, std::move(caller));
+            });
+        assert(!c);
+    }
+}
+
 }
 
 
 void idle(scheduler& sched) {
     scheduler_saver _ (sched);
+    sched.counters.idle_entries.add();
 
+    sched.run_timers();
+    sched.poll_io();
     auto next = sched.pop();
     if (next == 0) {
-        sched.waiting.exchange(true);
-        sched.waiter.reset();
-        while ((next = sched.pop()) == 0)
-            sched.waiter.wait();
-        sched.waiting.store(0, std::memory_order_relaxed);
+        int draining = scheduler::draining;
+        if (!sched.waits_pending() &&
+            sched.run_state.compare_exchange_strong(draining, scheduler::stopped))
+            return; // drained
+        next = sched.park();
     }
+    if (next == 0)
+        return; // timer due or stopping
 
     scheduler::node self;
+    self.cls = task_class::normal;
+    self.tenant = 0;
+    self.token = 0;
     auto old = callcc(
         std::move(next->task),
         [&](task_t task) {
             self.task = std::move(task);
-            sched.push(&self);
+            // the idle context is bound to its thread 
+            sched.push_pinned(&self);
             return task;
         });
     assert(!old);
 }
 
-future<scheduler*> start_background_scheduler() {
+std::vector<int> online_cpus(int numa_node) {
+    if (numa_node != -1)
+        return read_cpu_list("/sys/devices/system/node/node" +
+                             std::to_string(numa_node) + "/cpulist");
+    auto cpus = read_cpu_list("/sys/devices/system/cpu/online");
+    if (cpus.empty())
+        for (long cpu = 0; cpu < ::sysconf(_SC_NPROCESSORS_ONLN); ++cpu)
+            cpus.push_back(cpu);
+    return cpus;
+}
+
+std::vector<int> physical_cores(int numa_node) {
+    std::vector<int> cores;
+    for (int cpu : online_cpus(numa_node)) {
+        auto siblings = read_cpu_list
+            ("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+             "/topology/thread_siblings_list");
+        if (siblings.empty() || siblings.front() == cpu)
+            cores.push_back(cpu);
+    }
+    return cores;
+}
+
+std::vector<int> get_cpus(scheduler& sched) {
+    return sched.cpus;
+}
+
+future<scheduler*> start_background_scheduler(idle_policy policy) {
+    return start_background_scheduler(placement(), policy);
+}
+
+future<scheduler*> start_background_scheduler(placement where,
+                                              idle_policy policy) {
     promise<scheduler*> result;
     auto future = result.get_future();
-    std::thread th([result = std::move(result)] () mutable {
-            scheduler sched;
-            result.set_value(&sched);
-            while(true)
-                idle(sched);
+    std::thread th([result = std::move(result), where = std::move(where),
+                    policy] () mutable {
+            scheduler::run_thread(where, policy, result);
         });
     th.detach();
     return future;
 }
 
+background_scheduler::background_scheduler(idle_policy policy)
+    : background_scheduler(placement(), policy) {}
+
+background_scheduler::background_scheduler(placement where,
+                                           idle_policy policy) {
+    promise<scheduler*> result;
+    auto started = result.get_future();
+    thread = std::thread([result = std::move(result), where = std::move(where),
+                          policy] () mutable {
+            scheduler::run_thread(where, policy, result);
+        });
+    try {
+        sched.reset(started.get());
+    } catch (...) {
+        thread.join();
+        throw;
+    }
+}
+
+background_scheduler::~background_scheduler() {
+    if (thread.joinable()) {
+        stop();
+        join();
+    }
+}
+
+void background_scheduler::drain() {
+    sched->request_stop(scheduler::draining);
+}
+
+void background_scheduler::stop() {
+    sched->request_stop(scheduler::stopped);
+}
+
+void background_scheduler::join() {
+    thread.join();
+    sched.reset();
+}
+
+scheduler_pool::scheduler_pool(std::size_t workers, idle_policy policy)
+    : scheduler_pool(std::vector<placement>(std::max<std::size_t>(workers, 1)),
+                     policy) {}
+
+scheduler_pool::scheduler_pool(std::vector<placement> workers,
+                               idle_policy policy)
+    : self(new state(std::max<std::size_t>(workers.size(), 1))) {
+    workers.resize(self->schedulers.size());
+    // each scheduler is allocated by its worker once bound, so that
+    // first touch puts it next to the cpus it runs on; the workers
+    // only start once all are published, as they steal from each other
+    std::vector<future<int> > bound;
+    std::vector<promise<int> > start(workers.size());
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        promise<int> result;
+        bound.push_back(result.get_future());
+        self->threads.emplace_back
+            ([this, i, policy, where = std::move(workers[i]),
+              result = std::move(result),
+              started = start[i].get_future()] () mutable {
+                std::vector<int> cpus;
+                int error = bind_thread(where, cpus);
+                if (!error) {
+                    auto sched = new scheduler(policy);
+                    sched->pool = self.get();
+                    sched->index = i;
+                    sched->cpus = std::move(cpus);
+                    self->schedulers[i].reset(sched);
+                }
+                result.set_value(error);
+                if (started.get())
+                    return;
+                while (!self->stopping)
+                    idle(*self->schedulers[i]);
+            });
+    }
+    int error = 0;
+    for (auto& f : bound)
+        error = std::max(error, f.get());
+    for (auto& p : start)
+        p.set_value(error);
+    if (error) {
+        for (auto& th : self->threads)
+            th.join();
+        throw std::system_error(error, std::system_category(),
+                                "scheduler affinity");
+    }
+}
+
+void scheduler_pool::state::stop() {
+    stopping = true;
+    for (auto& sched : schedulers)
+        sched->wake();
+    for (auto& th : threads)
+        th.join();
+}
+
+scheduler_pool::~scheduler_pool() {
+    self->stop();
+}
+
+std::size_t scheduler_pool::size() const {
+    return self->schedulers.size();
+}
+
+scheduler& scheduler_pool::operator[](std::size_t i) {
+    return *self->schedulers[i];
+}
+
+idle_stats get_idle_stats(scheduler& sched) {
+    return sched.waiter.stats();
+}
+
+void set_run_next(scheduler& sched, unsigned limit) {
+    sched.run_next_limit.store(limit, std::memory_order_relaxed);
+}
+
+void set_tenant_weight(scheduler& sched, unsigned tenant, unsigned weight) {
+    sched.ready.set_weight(tenant, weight);
+}
+
+scheduler_stats get_stats(scheduler& sched) {
+    auto& c = sched.counters;
+    scheduler_stats s;
+    s.pinned_pops = c.pinned_pops.get();
+    s.local_pops = c.local_pops.get();
+    s.remote_pops = c.remote_pops.get();
+    s.steals = c.steals.get();
+    s.tasks_run = s.pinned_pops + s.local_pops + s.steals;
+    s.idle_entries = c.idle_entries.get();
+    s.parks = c.parks.get();
+    s.parked = std::chrono::nanoseconds(c.parked_ns.get());
+    s.idle = sched.waiter.stats();
+    s.wakeups = sched.wakeups.load(std::memory_order_relaxed);
+    s.wakeup_syscalls = s.idle.wake +
+        sched.eventfd_writes.load(std::memory_order_relaxed);
+    s.pinned_depth = c.pinned_queued.get();
+    s.local_depth = c.tasks_queued.get();
+    for (auto& d : sched.deques)
+        s.local_depth += d.size();
+    auto pushed = sched.remote_pushes.load(std::memory_order_relaxed);
+    s.remote_depth = pushed > s.remote_pops ? pushed - s.remote_pops : 0;
+    return s;
+}
+
+scheduler& scheduler_pool::target() {
+    if (scheduler_ptr && scheduler_ptr->pool == self.get())
+        return *scheduler_ptr;
+    return *self->schedulers[self->next++ % self->schedulers.size()];
+}
+
+
+
+timer::timer(clock::time_point deadline)
+    : deadline_(deadline)
+    , sched(&details::scheduler_get_local()) {
+    sched->add_timer(this);
+}
+
+timer::~timer() {
+    if (ev.ready())
+        return;
+    // the wheel is only touched by its thread
+    if (scheduler_ptr != sched)
+        yield(*sched);
+    sched->cancel_timer(this);
+}
+
+io_event::io_event(int fd, direction dir)
+    : fd(fd)
+    , dir(dir)
+    , sched(&details::scheduler_get_local()) {
+    sched->reactor().add(fd, epoll_reactor::direction(dir), &ev);
+}
+
+io_event::~io_event() {
+    if (ev.ready())
+        return;
+    // the reactor is only touched by its thread
+    if (scheduler_ptr != sched)
+        yield(*sched);
+    sched->reactor().remove(fd, epoll_reactor::direction(dir), &ev);
+}
+
+void wait_readable(int fd) {
+    io_event e(fd, io_event::read);
+    wait(pool, e);
+}
+
+void wait_writable(int fd) {
+    io_event e(fd, io_event::write);
+    wait(pool, e);
+}
+
+namespace {
+struct uring_op {
+    event ev;
+    int result = 0;
+};
+
+// Queue an operation on the local ring, suspend until its completion
+// and return its result, or -ENOSYS without io_uring.
+template<class Prep>
+int uring_submit(Prep prep) {
+    while (true) {
+        auto& sched = details::scheduler_get_local();
+        auto ring = sched.io_ring();
+        if (!ring)
+            return -ENOSYS;
+        if (auto sqe = ring->get_sqe()) {
+            uring_op op;
+            prep(*sqe);
+            sqe->user_data = reinterpret_cast<std::uint64_t>(&op);
+            event * e = &op.ev;
+            // not cancellable: the kernel owns 'op' until completion
+            auto token = std::exchange(sched.token, nullptr);
+            wait(pool, e);
+            details::scheduler_get_local().token = token;
+            return op.result;
+        }
+        yield(); // full: let the idle task submit and reap
+    }
+}
+
+// Run 'prep' through io_uring, or 'fallback' (a system call) without
+// it; retry on EAGAIN once 'fd' is ready, as non blocking descriptors
+// fail fast in io_uring too.
+template<class Prep, class Fallback>
+long uring_io(int fd, io_event::direction dir, Prep prep, Fallback fallback) {
+    while (true) {
+        long ret = uring_submit(prep);
+        if (ret == -ENOSYS) {
+            ret = fallback();
+            if (ret == -1) ret = -errno;
+        }
+        if (ret == -EAGAIN) {
+            io_event e(fd, dir);
+            wait(pool, e);
+            continue;
+        }
+        if (ret < 0) {
+            errno = -ret;
+            return -1;
+        }
+        return ret;
+    }
+}
+}
+
+void scheduler::complete(io_uring_cqe const& cqe) {
+    auto op = reinterpret_cast<uring_op*>(cqe.user_data);
+    op->result = cqe.res;
+    op->ev.signal();
+}
 
+ssize_t read(int fd, void * buf, std::size_t count, off_t offset) {
+    return uring_io(fd, io_event::read, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(buf);
+            sqe.len = count;
+            sqe.off = offset;
+        }, [&] {
+            return offset == -1 ? ::read(fd, buf, count)
+                : ::pread(fd, buf, count, offset);
+        });
+}
+
+ssize_t write(int fd, const void * buf, std::size_t count, off_t offset) {
+    return uring_io(fd, io_event::write, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_WRITE;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(buf);
+            sqe.len = count;
+            sqe.off = offset;
+        }, [&] {
+            return offset == -1 ? ::write(fd, buf, count)
+                : ::pwrite(fd, buf, count, offset);
+        });
+}
+
+int accept(int fd, sockaddr * addr, socklen_t * len, int flags) {
+    return uring_io(fd, io_event::read, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_ACCEPT;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(addr);
+            sqe.addr2 = reinterpret_cast<std::uint64_t>(len);
+            sqe.accept_flags = flags;
+        }, [&] {
+            return ::accept4(fd, addr, len, flags);
+        });
+}
+
+int connect(int fd, const sockaddr * addr, socklen_t len) {
+    bool started = false;
+    return uring_io(fd, io_event::write, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_CONNECT;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(addr);
+            sqe.off = len;
+        }, [&] {
+            // non blocking: once writable, the outcome is in SO_ERROR
+            if (!started) {
+                started = true;
+                int ret = ::connect(fd, addr, len);
+                if (ret == -1 && errno == EINPROGRESS)
+                    errno = EAGAIN;
+                return ret;
+            }
+            int error = 0;
+            socklen_t size = sizeof(error);
+            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size);
+            errno = error;
+            return error ? -1 : 0;
+        });
+}
+
+int fsync(int fd) {
+    return uring_io(fd, io_event::write, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.fd = fd;
+        }, [&] {
+            return ::fsync(fd);
+        });
+}
+
+void sleep_until(timer::clock::time_point deadline) {
+    timer t(deadline);
+    wait(pool, t);
+}
+
+void details::background_sleep_until(timer::clock::time_point deadline) {
+    timer t(deadline);
+    scheduler::set_background(t);
+    wait(pool, t);
+}
 
 void yield(scheduler& target, task_t next) {
     scheduler::node self;
@@ -158,16 +1130,164 @@ void yield(scheduler& target, task_t next) {
     assert(!old);
 }
 
+namespace details {
+
+void yield_as(scheduler& target, task_t next, unsigned tenant) {
+    scheduler::node self;
+    self.tenant = tenant;
+    auto old = callcc(
+        std::move(next),
+        [&](task_t task) {
+            self.task = std::move(task);
+            target.push(&self);
+            return task;
+        });
+    assert(!old);
+}
+
+}
+
+void set_task_class(task_class cls) {
+    details::scheduler_get_local().cls = cls;
+}
+
+task_class get_task_class() {
+    return details::scheduler_get_local().cls;
+}
+
+void set_tenant(unsigned tenant) {
+    assert(tenant < tenant_count);
+    details::scheduler_get_local().tenant = tenant;
+}
+
+unsigned get_tenant() {
+    return details::scheduler_get_local().tenant;
+}
+
+void yield(task_batch& batch, task_t next) {
+    scheduler::node self;
+    auto old = callcc(
+        std::move(next),
+        [&](task_t task) {
+            self.task = std::move(task);
+            if (batch.last)
+                batch.last->m_next.store(&self, std::memory_order_relaxed);
+            else
+                batch.first = &self;
+            batch.last = &self;
+            ++batch.count;
+            return task;
+        });
+    assert(!old);
+}
+
+void task_batch::post(scheduler& target) {
+    if (!first)
+        return;
+    target.post_many(first, last);
+    first = last = 0;
+    count = 0;
+}
+
 void yield(scheduler& target) {
     yield(target, details::scheduler_pop());
 }
 
 void yield(task_t next) {
-    yield(details::scheduler_get_local(), std::move(next));
+    auto& sched = details::scheduler_get_local();
+    scheduler::node self;
+    auto old = callcc(
+        std::move(next),
+        [&](task_t task) {
+            self.task = std::move(task);
+            sched.push_back(&self);
+            return task;
+        });
+    assert(!old);
 }
 
 void yield() {
-    yield(details::scheduler_get_local(), details::scheduler_pop());
+    yield(details::scheduler_pop());
+    check_cancellation();
+}
+
+void set_cancellation(cancellation_token* token) {
+    details::scheduler_get_local().token = token;
+}
+
+cancellation_token* get_cancellation() {
+    return details::scheduler_get_local().token;
+}
+
+void check_cancellation() {
+    auto token = details::scheduler_get_local().token;
+    if (token && token->cancelled())
+        throw task_cancelled();
+}
+
+cancellation_token* details::scheduler_cancellation() {
+    return scheduler_get_local().token;
+}
+
+// A task blocked in a cancellable wait; 'ev' is waited together with
+// the events of the wait and signaled by cancel().
+struct cancellation_token::slot {
+    event ev;
+    slot * prev = 0;
+    slot * next = 0;
+};
+
+void cancellation_token::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    flag.store(true, std::memory_order_relaxed);
+    for (auto s = waiting; s; s = s->next)
+        s->ev.signal();
+}
+
+bool cancellation_token::add(slot& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cancelled())
+        return false;
+    s.next = waiting;
+    if (waiting)
+        waiting->prev = &s;
+    waiting = &s;
+    return true;
+}
+
+// Once removed, 's' is no longer signaled, so it can be destroyed.
+void cancellation_token::remove(slot& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    (s.prev ? s.prev->next : waiting) = s.next;
+    if (s.next)
+        s.next->prev = s.prev;
+}
+
+void details::cancellable_wait_any
+(cancellation_token& token, event** first, event** last) {
+    // a ready event wins over the cancellation
+    auto ready = [&] {
+        return std::any_of(first, last - 1, [](event* e) {
+                return !e || e->ready();
+            });
+    };
+    cancellation_token::slot slot;
+    if (!token.add(slot)) {
+        if (ready())
+            return;
+        throw task_cancelled();
+    }
+    last[-1] = &slot.ev;
+    struct {
+        event ** first, ** last;
+        event ** begin() const { return first; }
+        event ** end() const { return last; }
+    } events { first, last };
+    details::scheduler_waiter waiter;
+    gpd::wait_any(waiter, events);
+    token.remove(slot);
+    if (slot.ev.ready() && !ready())
+        throw task_cancelled();
 }
 
 void details::scheduler_waiter::signal(event_ptr p) {
@@ -188,4 +1308,36 @@ void details::scheduler_waiter::wait(std::uint32_t count) {
     assert(!to);
 }
 
+// The last of the children and the join to drop its reference
+// resumes the owner.
+void task_group::finish(std::exception_ptr e) {
+    if (e && !failed.exchange(true, std::memory_order_relaxed))
+        error = std::move(e);
+    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        details::scheduler_post(*joiner);
+}
+
+void task_group::join() {
+    if (pending.load(std::memory_order_acquire) > 1) {
+        details::scheduler_node node;
+        joiner = &node;
+        auto to = callcc
+            (details::scheduler_pop(),
+             [&](task_t c) {
+                node.task = std::move(c);
+                if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    details::scheduler_post(node);
+                return c;
+            });
+        assert(!to);
+        joiner = 0;
+        pending.store(1, std::memory_order_relaxed);
+    }
+    failed.store(false, std::memory_order_relaxed);
+    if (auto e = std::move(error)) {
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
 }
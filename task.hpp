@@ -3,15 +3,38 @@
 #include "continuation.hpp"
 #include "future.hpp"
 #include "node.hpp"
+#include "spin_waiter.hpp"
+#include "timer_wheel.hpp"
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cassert>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 namespace gpd {
 
 using task_t = continuation<void()>;
 
 struct scheduler;
+struct cancellation_token;
 
 
 constexpr struct scheduler_tag {} pool;
 
+/// Scheduling class of a task. A scheduler always runs the ready
+/// tasks of a higher class first, so a class can starve the ones
+/// below it; within a class tasks run in FIFO order.
+enum class task_class : unsigned char { latency, normal, batch };
+
+constexpr unsigned task_class_count = 3;
+
+/// Tenants a scheduler shares its time between, within each class:
+/// see set_tenant.
+constexpr unsigned tenant_count = 16;
+
 namespace details {
 
 struct scheduler_node : gpd::node {
@@ -19,9 +42,11 @@ struct scheduler_node : gpd::node {
     ~scheduler_node();
     bool stolen() const;
     
-    std::uint64_t pri;
     scheduler* sched;
     bool pinned;
+    task_class cls;
+    unsigned char tenant;
+    cancellation_token* token;
     task_t task;
 };
 
@@ -29,22 +54,354 @@ scheduler& scheduler_get_local();
 void scheduler_post(scheduler_node& n);
 task_t scheduler_pop();
 
+// As yield(target, next), the current task being resumed as 'tenant'.
+void yield_as(scheduler& target, task_t next, unsigned tenant);
+
+// A task to start: 'run' moves it onto the context it is started on
+// and runs it to completion, the first thing being to suspend
+// 'caller', e.g. by passing it to yield.
+struct task_job {
+    void (*run)(task_job*, task_t caller);
+};
+
+template<class F>
+struct task_job_impl : task_job {
+    explicit task_job_impl(F&& f) : task_job{&invoke}, f(std::move(f)) {}
+
+    static void invoke(task_job * p, task_t caller) {
+        F f(std::move(static_cast<task_job_impl*>(p)->f));
+        f(std::move(caller));
+    }
+
+    F f;
+};
+
+// Start 'job' on the context of a task of the current scheduler that
+// has finished, if one is spare, or else on a new one.
+void start_task(task_job& job);
+
+template<class F>
+void start_task(F f) {
+    task_job_impl<F> job(std::move(f));
+    start_task(static_cast<task_job&>(job));
+}
+
 struct scheduler_waiter : waiter, details::scheduler_node {
     std::atomic<std::int32_t> signal_counter = { 0 };
     void reset() { signal_counter.store(0, std::memory_order_relaxed); }
     void signal(event_ptr p) override;
     void wait(std::uint32_t count = 1);
 };
+
+cancellation_token* scheduler_cancellation();
+
+// Wait for any of the events in [first, last - 1) or for 'token' to
+// be cancelled, throwing task_cancelled in the latter case. The last
+// element is reserved.
+void cancellable_wait_any(cancellation_token& token, event** first, event** last);
 }
 
+/// How an idle scheduler waits for work: spin, then yield the
+/// thread, then block on a futex. A remote push only pays for a
+/// system call in the last case.
+using idle_policy = spin_policy;
+
+/// How many idle waits were resolved while spinning, yielding and
+/// blocked.
+using idle_stats = spin_stats;
+
 /// Asynchronously start a background thread and run a scheduler on
 /// it. Return a future pointer to the scheduler.
-future<scheduler*> start_background_scheduler();
+future<scheduler*> start_background_scheduler(idle_policy policy = {});
+
+/// The cpus a scheduler thread may run on: those listed, or every
+/// online cpu if none, restricted to the cpus of 'numa_node' unless
+/// -1. The default placement leaves the thread unbound.
+struct placement {
+    std::vector<int> cpus;
+    int numa_node = -1;
+};
+
+/// As above, with the thread affinity set as per 'where' before the
+/// scheduler is created, so that its memory is first touched there.
+/// The future holds a std::system_error if the affinity cannot be
+/// set.
+future<scheduler*> start_background_scheduler(placement where,
+                                              idle_policy policy = {});
+
+/// A scheduler on a thread of its own, which, unlike those of
+/// start_background_scheduler, can be stopped. Destruction stops it,
+/// if not stopped yet, and joins it.
+///
+/// Once stopped, the tasks the scheduler can reach are unwound: those
+/// queued, and those waiting for its timers, descriptors and io_uring
+/// operations. Their continuations are destroyed, which resumes them
+/// with an exit_exception, so that their destructors run; they must
+/// not suspend while unwinding. Tasks suspended on anything else, a
+/// future for example, must be done with before the scheduler stops,
+/// and nothing can be posted to it afterwards.
+struct background_scheduler {
+    explicit background_scheduler(idle_policy policy = {});
+    /// Throw std::system_error if the affinity cannot be set.
+    explicit background_scheduler(placement where, idle_policy policy = {});
+    background_scheduler(const background_scheduler&) = delete;
+    ~background_scheduler();
+
+    /// Valid until joined.
+    scheduler& get() const { return *sched; }
+
+    /// Stop once the ready queues are empty, no timer is armed and no
+    /// descriptor or io_uring operation is waited for: sleeping tasks
+    /// and those waiting for I/O run to completion first. Any thread.
+    void drain();
+
+    /// Stop as soon as the running task, if any, suspends. Any thread.
+    void stop();
+
+    /// Wait for the thread to exit, after drain() or stop(); not to be
+    /// called by a task of the scheduler.
+    void join();
+
+private:
+    std::unique_ptr<scheduler> sched;
+    std::thread thread;
+};
+
+/// The cpus 'sched' is bound to, in ascending order; empty if
+/// unbound.
+std::vector<int> get_cpus(scheduler& sched);
+
+/// The online cpus, of NUMA node 'numa_node' unless -1.
+std::vector<int> online_cpus(int numa_node = -1);
+
+/// One cpu per physical core, the first of its hardware threads, of
+/// NUMA node 'numa_node' unless -1.
+std::vector<int> physical_cores(int numa_node = -1);
+
+/// Idle wait statistics of 'sched'; can be called from any thread.
+idle_stats get_idle_stats(scheduler& sched);
+
+/// Counters of a scheduler. Counts are cumulative since its start;
+/// depths are approximate, as the queues are not read atomically.
+struct scheduler_stats {
+    std::uint64_t tasks_run    = 0; // pinned, local and stolen pops
+    std::uint64_t pinned_pops  = 0;
+    std::uint64_t local_pops   = 0; // ready queue (remote arrivals
+                                    // included) and own deques
+    std::uint64_t remote_pops  = 0; // drained from the remote queue
+    std::uint64_t steals       = 0; // from pool siblings
+    std::uint64_t idle_entries = 0; // idle loop iterations
+    std::uint64_t parks        = 0; // waits for work, timers or I/O
+    std::chrono::nanoseconds parked = {}; // time spent in those waits
+    std::uint64_t wakeups      = 0; // wake ups by other threads
+    std::uint64_t wakeup_syscalls = 0; // futex wakes and eventfd writes
+    std::size_t pinned_depth   = 0;
+    std::size_t local_depth    = 0;
+    std::size_t remote_depth   = 0;
+    idle_stats idle;
+};
+
+/// Run a task made ready by another task of 'sched', e.g. by
+/// signaling an event it waits for, before anything else queued:
+/// request and response pairs of tasks stay hot in cache. To bound
+/// the unfairness, at most 'limit' tasks in a row are run this way
+/// before the queues get a turn. 0, the default, disables it, making
+/// the ready queue strictly FIFO. Can be called from any thread.
+void set_run_next(scheduler& sched, unsigned limit);
+
+/// Snapshot of the counters of 'sched'; can be called from any
+/// thread. The counters are plain relaxed atomics, written by the
+/// scheduler thread only but for the remote pushes and wake ups.
+scheduler_stats get_stats(scheduler& sched);
+
+/// A set of schedulers, each running on its own thread. Tasks made
+/// ready on a worker are pushed on a work stealing deque; idle
+/// workers steal from their siblings before going to sleep, and a
+/// push wakes up an idle sibling if any. A worker runs its own
+/// deque newest first; a task calling yield() goes to the back of
+/// its worker ready queue instead, where it is not stolen.
+///
+/// Pinned tasks are never stolen. The pool must be quiescent (no
+/// task pending or suspended on it) when destroyed.
+struct scheduler_pool {
+    explicit scheduler_pool
+    (std::size_t workers = std::thread::hardware_concurrency(),
+     idle_policy policy = {});
+
+    /// One worker per placement, e.g. one per physical core. Throw
+    /// std::system_error if a worker affinity cannot be set.
+    explicit scheduler_pool(std::vector<placement> workers,
+                            idle_policy policy = {});
+    scheduler_pool(const scheduler_pool&) = delete;
+    ~scheduler_pool();
+
+    std::size_t size() const;
+    scheduler& operator[](std::size_t i);
+
+    /// The scheduler of the calling worker if called from a task
+    /// running on the pool, else the next worker in round robin
+    /// order.
+    scheduler& target();
+
+    struct state;
+private:
+    std::unique_ptr<state> self;
+};
+
+/// Tasks to be posted to a scheduler together, in the order they
+/// were added: the whole batch costs a single exchange on the target
+/// remote queue and at most one wake up, instead of one each per
+/// task. Not thread safe; must be empty when destroyed.
+struct task_batch {
+    task_batch() = default;
+    task_batch(const task_batch&) = delete;
+    ~task_batch() { assert(empty()); }
+
+    bool empty() const { return !first; }
+    std::size_t size() const { return count; }
+
+    /// Post every task to 'target' and empty the batch.
+    void post(scheduler& target);
+    void post(scheduler_pool& pool) { post(pool.target()); }
+
+private:
+    friend void yield(task_batch& batch, task_t next);
+    details::scheduler_node * first = 0;
+    details::scheduler_node * last = 0;
+    std::size_t count = 0;
+};
+
+/// Thrown in a task whose cancellation token has been cancelled.
+struct task_cancelled : std::exception {
+    const char* what() const noexcept override { return "task cancelled"; }
+};
+
+/// Cooperative cancellation of the tasks it is attached to. Once
+/// cancelled, their scheduler waits (wait, wait_any and wait_all on
+/// pool, hence future gets, sleeps and readiness waits too) are
+/// woken up and throw task_cancelled, as do yield() and
+/// check_cancellation(). I/O submitted to io_uring is not
+/// interrupted: the task is cancelled at its next wait. Must outlive
+/// the tasks attached to it.
+struct cancellation_token {
+    cancellation_token() = default;
+    cancellation_token(const cancellation_token&) = delete;
+    ~cancellation_token() { assert(!waiting); }
+
+    /// Can be called from any thread, more than once.
+    void cancel();
+
+    bool cancelled() const { return flag.load(std::memory_order_relaxed); }
+
+    struct slot;
+private:
+    friend void details::cancellable_wait_any
+    (cancellation_token&, event**, event**);
+    bool add(slot& s);
+    void remove(slot& s);
+    std::atomic<bool> flag = { false };
+    std::mutex mutex;
+    slot * waiting = 0; // the tasks blocked in a wait
+};
+
+/// Attach the current task to 'token', or detach it if null. Tasks
+/// start attached to the token of the task that created them.
+void set_cancellation(cancellation_token* token);
+
+/// The token the current task is attached to, if any.
+cancellation_token* get_cancellation();
+
+/// Throw task_cancelled if the current task has been cancelled.
+void check_cancellation();
+
+/// Structured fan-out: children spawned into the group run as
+/// independent tasks and join() suspends the owner once, until all of
+/// them are done. The group only counts the running children: unlike
+/// async, a child costs no shared state and no event registration.
+/// Results are discarded; children report through captured state.
+///
+/// The first exception thrown by a child is rethrown by join(); the
+/// others are dropped and the remaining children run to completion.
+/// spawn and join are to be called by the task owning the group, and
+/// the group joined before being destroyed. It can be reused after a
+/// join.
+///
+/// Children are attached to the cancellation token of the spawning
+/// task, or to 'token' if given.
+struct task_group {
+    task_group() = default;
+    explicit task_group(cancellation_token& token) : token(&token) {}
+    task_group(const task_group&) = delete;
+    ~task_group() { assert(pending.load(std::memory_order_relaxed) == 1); }
+
+    /// Number of children not done yet.
+    std::size_t size() const {
+        return pending.load(std::memory_order_relaxed) - 1;
+    }
+
+    template<class F>
+    void spawn(scheduler& target, F&&f);
+
+    template<class F>
+    void spawn(scheduler_tag, F&&f);
+
+    template<class F>
+    void spawn(scheduler_pool& pool, F&&f);
+
+    /// Wait for every child spawned so far, then rethrow the first
+    /// exception if any.
+    void join();
+
+private:
+    void finish(std::exception_ptr e);
+    std::atomic<std::int32_t> pending = { 1 }; // children plus the join
+    std::atomic<bool> failed = { false };
+    std::exception_ptr error;
+    details::scheduler_node * joiner = 0;
+    cancellation_token * token = 0;
+};
+
+/// Set the class of the current task, task_class::normal by
+/// default. Tasks start with the class of the task that created
+/// them. Takes effect from the next time the task is suspended.
+void set_task_class(task_class cls);
+
+/// The class of the current task.
+task_class get_task_class();
+
+/// Set the tenant of the current task, 0 by default, below
+/// tenant_count. Within a class, a scheduler serves the tenants with
+/// ready tasks in deficit round robin, each in proportion to its
+/// weight: a tenant flooding the scheduler only delays the others by
+/// its share, not by the length of its backlog. Running a task costs
+/// its tenant a turn, plus one for every 50us it runs before
+/// suspending, if other tenants of its class are waiting, up to 8
+/// rounds of its weight: short tasks share turns, long running ones
+/// share time, and a tenant stops paying once it has no ready
+/// tasks. Tasks start with the tenant given to async, or else with
+/// the tenant of the task that created them. Takes effect from the
+/// next time the task is suspended, e.g. by yield().
+///
+/// In a scheduler_pool, the tasks on the work stealing deques are
+/// not shared out by tenant; those arriving from other threads are.
+/// Neither is the task in the run next slot, see set_run_next.
+void set_tenant(unsigned tenant);
+
+/// The tenant of the current task.
+unsigned get_tenant();
+
+/// Turns of 'tenant' on 'sched' in each round, 1 by default. Can be
+/// called from any thread.
+void set_tenant_weight(scheduler& sched, unsigned tenant, unsigned weight);
 
 /// Push current continuation at the back of target scheduler ready
 /// queue and jump to 'next' continuation.
 void yield(scheduler& target, task_t next);
 
+/// Append current continuation to 'batch' and jump to 'next'
+/// continuation. It is resumed once the batch is posted.
+void yield(task_batch& batch, task_t next);
+
 /// Push current continuation at the back of target scheduler ready
 /// queue and pop and jump to the continuation at front of the current
 /// scheduler ready queue.
@@ -56,15 +413,132 @@ void yield(task_t next);
 
 /// Push current continuation at the back of the current
 /// scheduler ready queue and pop and jump to the continuation at
-/// front of the current scheduler ready queue queue.
+/// front of the current scheduler ready queue queue. Throw
+/// task_cancelled once resumed if the task has been cancelled.
 void yield();
 
+/// One shot event signaled once 'deadline' has passed, by the
+/// scheduler of the task that created it. Can be used with wait_any
+/// to time out a wait. Must be created and destroyed by tasks.
+struct timer : private timer_wheel::node {
+    typedef timer_wheel::clock clock;
+
+    explicit timer(clock::time_point deadline);
+
+    template<class Rep, class Period>
+    explicit timer(std::chrono::duration<Rep, Period> d)
+        : timer(clock::now() +
+                std::chrono::duration_cast<clock::duration>(d)) {}
+
+    timer(const timer&) = delete;
+    ~timer();
+
+    clock::time_point deadline() const { return deadline_; }
+    bool expired() const { return ev.ready(); }
+
+    friend event* get_event(timer& t) { return &t.ev; }
+private:
+    friend struct scheduler;
+    event ev;
+    clock::time_point deadline_;
+    scheduler* sched;
+    bool background = false;
+};
+
+/// One shot event signaled once 'fd' is ready for reading or
+/// writing, by the reactor of the scheduler of the task that created
+/// it. Can be combined with other events, a timer for example, in
+/// wait_any. At most one io_event per descriptor and direction can
+/// be alive at any time. Must be created and destroyed by tasks.
+struct io_event {
+    enum direction { read, write };
+
+    io_event(int fd, direction dir);
+    io_event(const io_event&) = delete;
+    ~io_event();
+
+    bool ready() const { return ev.ready(); }
+
+    friend event* get_event(io_event& e) { return &e.ev; }
+private:
+    event ev;
+    int fd;
+    direction dir;
+    scheduler* sched;
+};
+
+/// Suspend the current task until 'fd' is ready for reading. 
+void wait_readable(int fd);
+
+/// Suspend the current task until 'fd' is ready for writing.
+void wait_writable(int fd);
+
+/// I/O operations for tasks, through the io_uring of the current
+/// scheduler. They suspend the calling task only; the submissions of
+/// every task are handed to the kernel together, once per idle
+/// iteration of the scheduler, and the tasks are resumed as their
+/// completions are reaped. The result and errors are as for the
+/// corresponding system calls. Without io_uring support they fall
+/// back to the system call, waiting on the reactor for EAGAIN.
+///
+/// 'offset' -1 means the current file position.
+///@{
+ssize_t read(int fd, void * buf, std::size_t count, off_t offset = -1);
+ssize_t write(int fd, const void * buf, std::size_t count, off_t offset = -1);
+int accept(int fd, sockaddr * addr = 0, socklen_t * len = 0, int flags = 0);
+int connect(int fd, const sockaddr * addr, socklen_t len);
+int fsync(int fd);
+///@}
+
+/// Suspend the current task until 'deadline'; other tasks keep
+/// running on the scheduler meanwhile.
+void sleep_until(timer::clock::time_point deadline);
+
+/// Suspend the current task for at least 'd'.
+template<class Rep, class Period>
+void sleep_for(std::chrono::duration<Rep, Period> d);
+
+namespace details {
+// As sleep_until, but a draining scheduler does not wait for it: the
+// task is unwound with the others once the rest of the work is done.
+void background_sleep_until(timer::clock::time_point deadline);
+}
+
+/// Run 'f' as a new task on 'target' and return a future of its
+/// result. Called from a task, the new task runs on the context of
+/// a finished task of the current scheduler if one is spare: it then
+/// costs a context switch rather than a stack allocation.
 template<class F>
 auto async(scheduler& target, F&&f);
 
 template<class F>
 auto async(scheduler_tag, F&&f);
 
+template<class F>
+auto async(scheduler_pool& pool, F&&f);
+
+/// As async(target, f), but the new task, and those it creates, run
+/// as 'tenant' instead of the tenant of the caller: see set_tenant.
+template<class F>
+auto async(scheduler& target, unsigned tenant, F&&f);
+
+template<class F>
+auto async(scheduler_tag, unsigned tenant, F&&f);
+
+template<class F>
+auto async(scheduler_pool& pool, unsigned tenant, F&&f);
+
+/// As async(scheduler&, f), but the task only starts once 'batch' is
+/// posted.
+template<class F>
+auto async(task_batch& batch, F&&f);
+
+/// Call f(get_stats(sched)) every 'period', from a task on 'sched',
+/// until it returns false. The reporter does not hold off drain(): it
+/// is unwound, as any other task, once the scheduler stops.
+template<class F>
+void report_stats(scheduler& sched, timer::clock::duration period, F f);
+
 
 /// wait{,_any,_all} customization point for the scheduler
 template<class... Waitable>
@@ -77,6 +551,12 @@ template<class Waitable>
 void wait_adl(scheduler_tag, Waitable& w);
 //// implementation
 
+template<class Rep, class Period>
+void sleep_for(std::chrono::duration<Rep, Period> d) {
+    sleep_until(timer::clock::now() +
+                std::chrono::duration_cast<timer::clock::duration>(d));
+}
+
 template<class F>
 auto async(scheduler& target, F&&f)  {
 
@@ -85,15 +565,14 @@ auto async(scheduler& target, F&&f)  {
         std::decay_t<F> f;
         gpd::promise<decltype(f())> promise;
 
-        auto operator()(task_t caller) {
+        void operator()(task_t caller) {
             yield(target, std::move(caller));
             eval_into(promise, f);
-            return details::scheduler_pop();
         }
     } run { target, std::forward<F>(f), {} };
     
     auto future = run.promise.get_future();
-    auto c = callcc(std::move(run));
+    details::start_task(std::move(run));
     return future;
 }
 
@@ -102,15 +581,134 @@ auto async(scheduler_tag, F&&f) {
     return async(details::scheduler_get_local(), std::forward<F>(f));
 }
 
+template<class F>
+auto async(scheduler_pool& pool, F&&f) {
+    return async(pool.target(), std::forward<F>(f));
+}
+
+template<class F>
+auto async(scheduler& target, unsigned tenant, F&&f)  {
+    assert(tenant < tenant_count);
+
+    struct {
+        scheduler& target;
+        unsigned tenant;
+        std::decay_t<F> f;
+        gpd::promise<decltype(f())> promise;
+
+        void operator()(task_t caller) {
+            details::yield_as(target, std::move(caller), tenant);
+            eval_into(promise, f);
+        }
+    } run { target, tenant, std::forward<F>(f), {} };
+    
+    auto future = run.promise.get_future();
+    details::start_task(std::move(run));
+    return future;
+}
+
+template<class F>
+auto async(scheduler_tag, unsigned tenant, F&&f) {
+    return async(details::scheduler_get_local(), tenant, std::forward<F>(f));
+}
+
+template<class F>
+auto async(scheduler_pool& pool, unsigned tenant, F&&f) {
+    return async(pool.target(), tenant, std::forward<F>(f));
+}
+
+template<class F>
+void task_group::spawn(scheduler& target, F&&f) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    struct {
+        scheduler& target;
+        task_group& group;
+        std::decay_t<F> f;
+
+        void operator()(task_t caller) {
+            yield(target, std::move(caller));
+            std::exception_ptr e;
+            try {
+                if (group.token)
+                    set_cancellation(group.token);
+                check_cancellation();
+                f();
+            } catch(exit_exception&) {
+                throw; // unwound by a stopping scheduler
+            } catch(...) {
+                e = std::current_exception();
+            }
+            group.finish(std::move(e));
+        }
+    } run { target, *this, std::forward<F>(f) };
+
+    details::start_task(std::move(run));
+}
+
+template<class F>
+void task_group::spawn(scheduler_tag, F&&f) {
+    spawn(details::scheduler_get_local(), std::forward<F>(f));
+}
+
+template<class F>
+void task_group::spawn(scheduler_pool& pool, F&&f) {
+    spawn(pool.target(), std::forward<F>(f));
+}
+
+template<class F>
+void report_stats(scheduler& sched, timer::clock::duration period, F f) {
+    async(sched, [&sched, period, f = std::move(f)] () mutable {
+            do
+                details::background_sleep_until(timer::clock::now() + period);
+            while (f(get_stats(sched)));
+            return true;
+        });
+}
+
+template<class F>
+auto async(task_batch& batch, F&&f)  {
+
+    struct {
+        task_batch& batch;
+        std::decay_t<F> f;
+        gpd::promise<decltype(f())> promise;
+
+        void operator()(task_t caller) {
+            yield(batch, std::move(caller));
+            eval_into(promise, f);
+        }
+    } run { batch, std::forward<F>(f), {} };
+    
+    auto future = run.promise.get_future();
+    details::start_task(std::move(run));
+    return future;
+}
+
 
 template<class... Waitable>
 void wait_any_adl(scheduler_tag, Waitable&... w) {
+    if (auto * token = details::scheduler_cancellation()) {
+        event * events[] = { get_event(w)..., 0 };
+        details::cancellable_wait_any
+            (*token, std::begin(events), std::end(events));
+        return;
+    }
     details::scheduler_waiter waiter;
     gpd::wait_any(waiter, w...);
 }
 
 template<class... Waitable>
 void wait_all_adl(scheduler_tag, Waitable&... w) {
+    if (auto * token = details::scheduler_cancellation()) {
+        for (auto * e : { get_event(w)... }) {
+            event * events[] = { e, 0 };
+            if (e)
+                details::cancellable_wait_any
+                    (*token, std::begin(events), std::end(events));
+        }
+        return;
+    }
     details::scheduler_waiter waiter;
     gpd::wait_all(waiter, w...);
 }
@@ -118,6 +716,12 @@ void wait_all_adl(scheduler_tag, Waitable&... w) {
 template<class Waitable>
 void wait_adl(scheduler_tag, Waitable& w) {
     if (auto * event = get_event(w)) {    
+        if (auto * token = details::scheduler_cancellation()) {
+            gpd::event * events[] = { event, 0 };
+            details::cancellable_wait_any
+                (*token, std::begin(events), std::end(events));
+            return;
+        }
         struct task_latch : waiter, details::scheduler_node {
             void signal(event_ptr p) override {
                 p.release();
@@ -0,0 +1,72 @@
+#ifndef GPD_TESTS_BENCHMARK_HPP
+#define GPD_TESTS_BENCHMARK_HPP
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Minimal benchmark harness shared by the benchmark programs.
+ *
+ * Every case is a callable taking an iteration count 'n' and
+ * performing 'n * ops' operations. It is run 'warmup' times, then
+ * 'repetitions' times; each repetition is timed with both
+ * steady_clock and the time stamp counter and the per operation
+ * figures are summarised as percentiles over the repetitions.
+ **/
+namespace gpd { namespace bench {
+
+inline std::uint64_t rdtsc() {
+    unsigned hi, lo;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return std::uint64_t(lo) | (std::uint64_t(hi) << 32);
+}
+
+struct options {
+    long iterations;  // baseline 'n' for the cheap cases
+    int  warmup;
+    int  repetitions;
+};
+
+// nearest rank percentile over a sorted sample
+inline double percentile(std::vector<double> const& sorted, double p) {
+    std::size_t i = std::size_t(p / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+inline void print_header(const char * prefix = "") {
+    std::printf("%s%-28s %10s %10s %10s %10s %12s %12s\n", prefix, "case",
+                "min ns", "p50 ns", "p90 ns", "p99 ns",
+                "p50 cycles", "p99 cycles");
+}
+
+template<class F>
+void run(const char * name, long n, long ops, options const& opt, F f,
+         const char * prefix = "") {
+    n = std::max(n, 1L);
+    for (int i = 0; i < opt.warmup; ++i)
+        f(n);
+    std::vector<double> ns, cycles;
+    for (int i = 0; i < opt.repetitions; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto c0 = rdtsc();
+        f(n);
+        auto c1 = rdtsc();
+        auto t1 = std::chrono::steady_clock::now();
+        double count = double(n) * ops;
+        ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0)
+                     .count() / count);
+        cycles.push_back(double(c1 - c0) / count);
+    }
+    std::sort(ns.begin(), ns.end());
+    std::sort(cycles.begin(), cycles.end());
+    std::printf("%s%-28s %10.2f %10.2f %10.2f %10.2f %12.2f %12.2f\n",
+                prefix, name, ns.front(),
+                percentile(ns, 50), percentile(ns, 90), percentile(ns, 99),
+                percentile(cycles, 50), percentile(cycles, 99));
+    std::fflush(stdout);
+}
+
+}}
+#endif
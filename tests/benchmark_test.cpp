@@ -1,42 +1,158 @@
 #include "continuation.hpp"
-#include <iostream>
-#include <vector>
-#include <algorithm>
-#include <boost/lexical_cast.hpp>
-#include <boost/timer/timer.hpp>
+#include "stack_allocator.hpp"
+#include "benchmark.hpp"
+#include <cstdlib>
+#include <stdexcept>
 
 using namespace gpd;
 
+/**
+ * Context switch micro-benchmarks, to be compared across versions to
+ * catch regressions.
+ *
+ * usage: benchmark_test [iterations [repetitions [depth]]]
+ *
+ * The cases creating a context per operation run a fraction of
+ * 'iterations' so that every case takes roughly the same time.
+ **/
+
+volatile long sink;
+
+// Target of the raw round trip: bounce every switch straight back.
+switch_pair bounce(parm_t, cont from) {
+    while (true)
+        from = stack_switch(from, 0).sp;
+}
+
 template<class C>
 void traverse(C& out, int depth)
 {
     out(depth);
-    if (depth > 0) 
+    if (depth > 0)
         traverse(out, depth - 1);
 }
 
+typedef pooled_stack_allocator<> pool;
+
 int main(int argc, char*argv[])
 {
-    int depth = 
-        argc != 2 ? 10 : boost::lexical_cast<int>(std::string(argv[1]));
+    bench::options opt = {
+        argc > 1 ? std::atol(argv[1]) : 1000000,
+        2,
+        argc > 2 ? std::atoi(argv[2]) : 20
+    };
+    int depth = argc > 3 ? std::atoi(argv[3]) : 10;
+
+    bench::print_header();
 
-    for (int i =0; i < 4; ++i)
+    // the switch primitive alone: one operation is a round trip
     {
-        auto c = callcc([depth](continuation<void(int)> c) { 
-                traverse(c, depth); 
-                return c;
-            });
-        
-        {
-            boost::timer::auto_cpu_timer t;
-            while(c)
-            {
-                c();
-            }
-        }
+        alignas(16) static char stack[64*1024];
+        cont target =
+            execute_into(0, cont{ stack_bottom(stack, sizeof(stack)) },
+                         &bounce).sp;
+        bench::run("raw switch round trip", opt.iterations, 1, opt,
+                   [&](long n) {
+                       for (long i = 0; i < n; ++i)
+                           target = stack_switch(target, 0).sp;
+                   });
     }
-        
 
+    // creation, first entry, return and stack release
+    bench::run("callcc create+destroy", opt.iterations / 100, 1, opt,
+               [](long n) {
+                   for (long i = 0; i < n; ++i)
+                       callcc([](continuation<void()> c) { return c; });
+               });
+
+    bench::run("callcc create+destroy pool", opt.iterations / 10, 1, opt,
+               [](long n) {
+                   for (long i = 0; i < n; ++i)
+                       callcc(stack_hint(64*1024, pool()),
+                              [](continuation<void()> c) { return c; });
+               });
+
+    // a yield is a round trip carrying an int
+    bench::run("void(int) yield", opt.iterations, 1, opt, [](long n) {
+            auto c = callcc([n](continuation<void(int)> c) {
+                    for (long i = 0; i < n; ++i) c(int(i));
+                    return c;
+                });
+            long sum = 0;
+            while (c) { sum += c.get(); c(); }
+            sink = sum;
+        });
+
+    bench::run("void(int) recursive yield", opt.iterations / (depth + 1),
+               depth + 1, opt, [depth](long n) {
+                   for (long i = 0; i < n; ++i) {
+                       auto c = callcc(stack_hint(64*1024, pool()),
+                                       [depth](continuation<void(int)> c) {
+                                           traverse(c, depth);
+                                           return c;
+                                       });
+                       while (c) c();
+                   }
+               });
+
+    bench::run("input_iterator_adaptor", opt.iterations, 1, opt, [](long n) {
+            auto c = callcc([n](continuation<void(long)> c) {
+                    for (long i = 0; i < n; ++i) c(i);
+                    return c;
+                });
+            long sum = 0;
+            for (auto x : c) sum += x;
+            sink = sum;
+        });
+
+    // the baseline for the two below: suspend once, then return
+    bench::run("suspended create+return", opt.iterations / 10, 1, opt,
+               [](long n) {
+                   for (long i = 0; i < n; ++i) {
+                       auto c = callcc(stack_hint(64*1024, pool()),
+                                       [](continuation<void()> c) {
+                                           c();
+                                           return c;
+                                       });
+                       c();
+                   }
+               });
+
+    // a suspended context destroyed from outside unwinds via
+    // signal_exit
+    bench::run("signal_exit teardown", opt.iterations / 10, 1, opt,
+               [](long n) {
+                   for (long i = 0; i < n; ++i) {
+                       auto c = callcc(stack_hint(64*1024, pool()),
+                                       [](continuation<void()> c) {
+                                           c();
+                                           return c;
+                                       });
+                   }
+               });
 
+    // an exception escaping a context is transported to its caller
+    // by abnormal_exit_exception
+    bench::run("abnormal_exit propagation", opt.iterations / 10, 1, opt,
+               [](long n) {
+                   long caught = 0;
+                   for (long i = 0; i < n; ++i) {
+                       try {
+                           auto c = callcc(stack_hint(64*1024, pool()),
+                                           [](continuation<void()> c) {
+                                               c();
+                                               with_escape_continuation
+                                                   ([] {
+                                                       throw std::runtime_error
+                                                           ("escape");
+                                                   }, c);
+                                               return c;
+                                           });
+                           c();
+                       } catch (std::runtime_error&) {
+                           ++caught;
+                       }
+                   }
+                   sink = caught;
+               });
 }
- 
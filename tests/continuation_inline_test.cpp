@@ -0,0 +1,3 @@
+// Run the continuation tests with the inline context switch.
+#define GPD_INLINE_SWITCH
+#include "continuation_test.cpp"
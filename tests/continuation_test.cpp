@@ -2,6 +2,8 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cfenv>
+#include <xmmintrin.h>
 struct noncopyable {
     noncopyable(const noncopyable&) = delete;
     noncopyable(noncopyable&&rhs) : live(rhs.live) { rhs.live = false; }
@@ -559,6 +561,115 @@ int main() {
         std::copy(x.begin(),x.end(),
                   begin(pipeline));
     }
+    {
+        auto c = callcc(stack_hint(16*1024), [](continuation<void(int)> c) { 
+                c(42);
+                return c;
+            });
+        assert(c.get() == 42);
+        c();
+        assert(!c);
+    }
+    {
+        auto c = callcc<int()>(stack_hint(16*1024), [](continuation<void(int)> c, int x) { 
+                c(x);
+                return c;
+            }, 42);
+        assert(c.get() == 42);
+        c();
+        assert(!c);
+    }
+    {
+        auto c = callcc(stack_hint(64*1024, mmap_stack_allocator()),
+                        [](continuation<void(int)> c, int x) { 
+                c(x);
+                return c;
+            }, 42);
+        assert(c.get() == 42);
+        c();
+        assert(!c);
+    }
+    {
+        assert(std::fegetround() == FE_TONEAREST);
+        auto c = callcc(preserve_fpenv(stack_hint(64*1024)), 
+                        [](continuation<void()> c) { 
+                std::fesetround(FE_UPWARD);
+                c();
+                assert(std::fegetround() == FE_UPWARD);
+                c();
+                assert(std::fegetround() == FE_UPWARD);
+                return c;
+            });
+        assert(std::fegetround() == FE_TONEAREST);
+        std::fesetround(FE_DOWNWARD);
+        c();
+        assert(std::fegetround() == FE_DOWNWARD);
+        c();
+        assert(!c);
+        assert(std::fegetround() == FE_DOWNWARD);
+        std::fesetround(FE_TONEAREST);
+    }
+    {
+        // an opted in context switching to one that did not: each
+        // keeps its own, the latter the one of the thread
+        auto b = callcc(preserve_fpenv(stack_hint(64*1024)), 
+                        [](continuation<void()> c) { 
+                std::fesetround(FE_UPWARD);
+                auto d = callcc(stack_hint(64*1024), 
+                                [](continuation<void()> b) { 
+                        assert(std::fegetround() == FE_TONEAREST);
+                        std::fesetround(FE_DOWNWARD);
+                        b();
+                        // set by the main context meanwhile
+                        assert(std::fegetround() == FE_TONEAREST);
+                        return b;
+                    });
+                assert(std::fegetround() == FE_UPWARD);
+                c();
+                assert(std::fegetround() == FE_UPWARD);
+                d();
+                assert(!d);
+                assert(std::fegetround() == FE_UPWARD);
+                return c;
+            });
+        assert(std::fegetround() == FE_DOWNWARD);
+        std::fesetround(FE_TONEAREST);
+        b();
+        assert(!b);
+        assert(std::fegetround() == FE_TONEAREST);
+    }
+    {
+        // a new context that opted in starts with the state current
+        // at its creation, not with the one of the context starting it
+        struct seen { int round; unsigned mxcsr; } s = { 0, 0 };
+        alignas(16) static char stack[64*1024];
+        std::fesetround(FE_UPWARD);
+        cont fresh { fpenv_stack_bottom(stack, sizeof(stack)) };
+        std::fesetround(FE_DOWNWARD);
+        execute_into(&s, fresh, [](parm_t p, cont from) -> switch_pair {
+                auto s = static_cast<seen*>(p);
+                s->round = std::fegetround();
+                s->mxcsr = _mm_getcsr() & _MM_ROUND_MASK;
+                while (true)
+                    from = stack_switch(from, 0).sp;
+            });
+        assert(s.round == FE_UPWARD && s.mxcsr == _MM_ROUND_UP);
+        assert(std::fegetround() == FE_DOWNWARD);
+        assert((_mm_getcsr() & _MM_ROUND_MASK) == _MM_ROUND_DOWN);
+        std::fesetround(FE_TONEAREST);
+    }
+    {
+        // without opting in, the state follows the thread
+        auto c = callcc([](continuation<void()> c) { 
+                std::fesetround(FE_UPWARD);
+                c();
+                return c;
+            });
+        assert(std::fegetround() == FE_UPWARD);
+        std::fesetround(FE_TONEAREST);
+        c();
+        assert(!c);
+    }
     {
 
         auto c = callcc([](continuation<void()> c) {
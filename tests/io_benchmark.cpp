@@ -0,0 +1,100 @@
+#include "task.hpp"
+#include "future.hpp"
+#include "benchmark.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace gpd;
+
+/**
+ * Socket pair ping-pong between tasks of one scheduler, through the
+ * reactor (non blocking descriptors, wait_readable and the plain
+ * system calls) and through io_uring (gpd::read and gpd::write).
+ *
+ * usage: io_benchmark [iterations [repetitions]]
+ *
+ * One operation is a round trip of a single byte. With many pairs in
+ * flight, io_uring submits the operations of every task at once.
+ **/
+
+struct reactor_io {
+    static int flags() { return SOCK_NONBLOCK; }
+    static void read(int fd, char * c) {
+        while (::read(fd, c, 1) != 1)
+            wait_readable(fd);
+    }
+    static void write(int fd, const char * c) {
+        while (::write(fd, c, 1) != 1)
+            wait_writable(fd);
+    }
+};
+
+struct uring_io {
+    static int flags() { return 0; }
+    static void read(int fd, char * c) {
+        auto ret = gpd::read(fd, c, 1);
+        assert(ret == 1); (void)ret;
+    }
+    static void write(int fd, const char * c) {
+        auto ret = gpd::write(fd, c, 1);
+        assert(ret == 1); (void)ret;
+    }
+};
+
+template<class IO>
+void ping_pong(scheduler& sched, int pairs, long n) {
+    std::vector<future<bool> > done;
+    std::vector<int> fds(2 * pairs);
+    for (int i = 0; i < pairs; ++i) {
+        int ret = ::socketpair(AF_UNIX, SOCK_STREAM | IO::flags(), 0,
+                               &fds[2 * i]);
+        assert(ret == 0); (void)ret;
+        done.push_back(async(sched, [fd = fds[2 * i + 1], n] {
+                    char c;
+                    for (long j = 0; j < n; ++j) {
+                        IO::read(fd, &c);
+                        IO::write(fd, &c);
+                    }
+                    return true;
+                }));
+        done.push_back(async(sched, [fd = fds[2 * i], n] {
+                    char c = 'x';
+                    for (long j = 0; j < n; ++j) {
+                        IO::write(fd, &c);
+                        IO::read(fd, &c);
+                    }
+                    return true;
+                }));
+    }
+    for (auto& f : done)
+        f.get();
+    for (auto fd : fds)
+        ::close(fd);
+}
+
+int main(int argc, char*argv[])
+{
+    bench::options opt = {
+        argc > 1 ? std::atol(argv[1]) : 20000,
+        1,
+        argc > 2 ? std::atoi(argv[2]) : 5
+    };
+    auto& sched = *start_background_scheduler().get();
+
+    bench::print_header();
+    for (int pairs : { 1, 32 }) {
+        long n = opt.iterations / pairs;
+        char name[64];
+        std::snprintf(name, sizeof(name), "epoll ping-pong x%d", pairs);
+        bench::run(name, n, pairs, opt, [&](long n) {
+                ping_pong<reactor_io>(sched, pairs, n);
+            });
+        std::snprintf(name, sizeof(name), "io_uring ping-pong x%d", pairs);
+        bench::run(name, n, pairs, opt, [&](long n) {
+                ping_pong<uring_io>(sched, pairs, n);
+            });
+    }
+}
@@ -1,4 +1,5 @@
 #include "mpsc_queue.hpp"
+#include <cassert>
 #include <thread>
 #include <vector>
 #include <iostream>      
@@ -44,4 +45,42 @@ int main() {
                 }));
     for(auto& t: threads)
         t.join();
+
+    {
+        // batches from several producers: every chain is seen whole
+        // and in order
+        static const int producers = 4;
+        static const int batches = 1000;
+        static const int batch = 16;
+        queue q;
+        std::vector<std::thread> threads;
+        for(int id = 0; id < producers; ++id)
+            threads.push_back(std::thread([&q, id]() {
+                        for (int b = 0; b < batches; ++b) {
+                            val* first = new val(b * batch, id);
+                            val* last = first;
+                            for (int i = 1; i < batch; ++i) {
+                                val* n = new val(b * batch + i, id);
+                                last->m_next.store(n, std::memory_order_relaxed);
+                                last = n;
+                            }
+                            q.push_batch(first, last);
+                        }
+                    }));
+        std::vector<int> next(producers, 0);
+        for (int received = 0; received < producers * batches * batch;) {
+            val * p = q.pop();
+            if (!p) {
+                std::this_thread::yield();
+                continue;
+            }
+            assert(p->id == next[p->from]);
+            next[p->from]++;
+            received++;
+            delete p;
+        }
+        for(auto& t: threads)
+            t.join();
+        assert(q.pop() == 0);
+    }
 }
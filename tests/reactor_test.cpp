@@ -0,0 +1,127 @@
+#include "task.hpp"
+#include "future.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace gpd;
+
+// read exactly 'size' bytes from a non blocking descriptor
+void read_all(int fd, char * buf, std::size_t size) {
+    while (size) {
+        auto ret = ::read(fd, buf, size);
+        if (ret == -1) {
+            assert(errno == EAGAIN);
+            wait_readable(fd);
+            continue;
+        }
+        assert(ret > 0);
+        buf += ret;
+        size -= ret;
+    }
+}
+
+void write_all(int fd, const char * buf, std::size_t size) {
+    while (size) {
+        auto ret = ::write(fd, buf, size);
+        if (ret == -1) {
+            assert(errno == EAGAIN);
+            wait_writable(fd);
+            continue;
+        }
+        buf += ret;
+        size -= ret;
+    }
+}
+
+int main() {
+    using namespace std::chrono;
+    {
+        // echo over a socket pair, both ends served by tasks of the
+        // same scheduler; the payload exceeds the socket buffers
+        int fds[2];
+        int ret = ::socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, fds);
+        assert(ret == 0);
+        auto& sched = *start_background_scheduler().get();
+        const std::size_t size = 4 << 20;
+        auto server = async(sched, [fd = fds[1], size] {
+                std::string buf(64 * 1024, 0);
+                std::size_t total = 0;
+                while (total < size) {
+                    auto n = std::min(buf.size(), size - total);
+                    read_all(fd, &buf[0], n);
+                    write_all(fd, buf.data(), n);
+                    total += n;
+                }
+                return total;
+            });
+        auto client = async(sched, [fd = fds[0], size] {
+                std::string out(size, 0), in(size, 0);
+                for (std::size_t i = 0; i < size; ++i)
+                    out[i] = char(i * 7);
+                auto writer = async(pool, [&] {
+                        write_all(fd, out.data(), size);
+                        return true;
+                    });
+                read_all(fd, &in[0], size);
+                return writer.get(pool) && in == out;
+            });
+        assert(server.get() == size);
+        assert(client.get());
+
+        // time out a read
+        auto timed_out = async(sched, [fd = fds[0]] {
+                io_event readable(fd, io_event::read);
+                timer t(milliseconds(5));
+                wait_any(pool, readable, t);
+                return t.expired() && !readable.ready();
+            });
+        assert(timed_out.get());
+
+        // a read and a write waited for at the same time; the
+        // reader is woken up by a task on another scheduler
+        auto& other = *start_background_scheduler().get();
+        auto reader = async(sched, [fd = fds[0]] {
+                char c;
+                read_all(fd, &c, 1);
+                return c;
+            });
+        auto writer = async(sched, [fd = fds[0]] {
+                wait_writable(fd);
+                return true;
+            });
+        assert(writer.get());
+        // remote pushes interrupt the epoll wait
+        for (int i = 0; i < 10; ++i)
+            assert(async(sched, [i] { return i; }).get() == i);
+        auto remote = async(other, [fd = fds[1]] {
+                sleep_for(milliseconds(2));
+                write_all(fd, "x", 1);
+                return true;
+            });
+        assert(remote.get());
+        assert(reader.get() == 'x');
+
+        // peer closed
+        ::close(fds[1]);
+        auto eof = async(sched, [fd = fds[0]] {
+                wait_readable(fd);
+                char c;
+                return ::read(fd, &c, 1) == 0;
+            });
+        assert(eof.get());
+        ::close(fds[0]);
+    }
+    {
+        // regular files are always ready
+        int fd = ::open("/proc/self/stat", O_RDONLY);
+        assert(fd != -1);
+        auto& sched = *start_background_scheduler().get();
+        assert(async(sched, [fd] { wait_readable(fd); return true; }).get());
+        ::close(fd);
+    }
+}
@@ -0,0 +1,155 @@
+#include "task.hpp"
+#include "future.hpp"
+#include "mpsc_queue.hpp"
+#include "ready_queue.hpp"
+#include "benchmark.hpp"
+#include <cstdlib>
+#include <vector>
+
+using namespace gpd;
+
+/**
+ * Ready queue benchmarks.
+ *
+ * The first cases compare the queue structures alone, single
+ * threaded: the generation stamped merge of three mpsc queues the
+ * scheduler used before, and ready_queue with remote arrivals
+ * drained from an mpsc queue. One operation is a pop and a push.
+ *
+ * The scheduler cases measure the whole path through a background
+ * scheduler and can be compared across versions; one async operation
+ * is a task started, run and waited for.
+ *
+ * usage: ready_queue_benchmark [iterations [repetitions]]
+ **/
+
+struct item : gpd::node {
+    std::uint64_t pri = 0;
+    unsigned cls = 0;
+};
+
+// The former scheduler queues: pinned, local and remote, merged in
+// push order through a generation stamp peeked on every pop.
+struct legacy_queue {
+    void push_local(item* n) {
+        n->pri = ++generation;
+        tasks.push_unlocked(n);
+    }
+    void push_remote(item* n) {
+        n->pri = generation + 1;
+        remote.push(n);
+    }
+    item* pop() {
+        std::uint64_t pri[] = { get_pri(pinned), get_pri(tasks), get_pri(remote) };
+        return
+            pri[0] <=  pri[1] && pri[0] <= pri[2] ? pinned.pop_unlocked() :
+            pri[1] <= pri[2] ? tasks.pop_unlocked() :
+            remote.pop();
+    }
+    static std::uint64_t get_pri(mpsc_queue<item>& q) {
+        item * n = static_cast<item*>(q.peek());
+        return n ? n->pri : std::uint64_t(-1);
+    }
+    std::uint64_t generation = 0;
+    mpsc_queue<item> pinned, tasks, remote;
+};
+
+struct class_queue {
+    void push_local(item* n) { ready.push(n, n->cls); }
+    void push_remote(item* n) { remote.push(n); }
+    item* pop() {
+        if (!remote.empty())
+            while (item * n = remote.pop())
+                ready.push(n, n->cls);
+        return ready.pop();
+    }
+    ready_queue<item, 3> ready;
+    mpsc_queue<item> remote;
+};
+
+// 'depth' items cycling through the queue; one push in 'remote_every'
+// goes through the remote queue.
+template<class Queue>
+void cycle(long n, std::size_t depth, int remote_every) {
+    Queue q;
+    std::vector<item> items(depth);
+    for (auto& i : items)
+        q.push_local(&i);
+    for (long i = 0; i < n; ++i) {
+        item * x = q.pop();
+        if (remote_every && i % remote_every == 0)
+            q.push_remote(x);
+        else
+            q.push_local(x);
+    }
+    while (q.pop())
+        ;
+}
+
+int main(int argc, char*argv[])
+{
+    bench::options opt = {
+        argc > 1 ? std::atol(argv[1]) : 1000000,
+        2,
+        argc > 2 ? std::atoi(argv[2]) : 10
+    };
+
+    bench::print_header();
+    bench::run("legacy local x1", opt.iterations, 1, opt, [](long n) {
+            cycle<legacy_queue>(n, 1, 0);
+        });
+    bench::run("classes local x1", opt.iterations, 1, opt, [](long n) {
+            cycle<class_queue>(n, 1, 0);
+        });
+    bench::run("legacy local x64", opt.iterations, 1, opt, [](long n) {
+            cycle<legacy_queue>(n, 64, 0);
+        });
+    bench::run("classes local x64", opt.iterations, 1, opt, [](long n) {
+            cycle<class_queue>(n, 64, 0);
+        });
+    bench::run("legacy 1/8 remote x64", opt.iterations, 1, opt, [](long n) {
+            cycle<legacy_queue>(n, 64, 8);
+        });
+    bench::run("classes 1/8 remote x64", opt.iterations, 1, opt, [](long n) {
+            cycle<class_queue>(n, 64, 8);
+        });
+
+    auto& sched = *start_background_scheduler().get();
+    for (int tasks : { 1, 64 }) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "scheduler yield x%d", tasks);
+        bench::run(name, opt.iterations / tasks, tasks, opt, [&](long n) {
+                async(sched, [&] {
+                        std::vector<future<int> > done;
+                        for (int t = 0; t < tasks; ++t)
+                            done.push_back(async(pool, [n] {
+                                        for (long i = 0; i < n; ++i)
+                                            yield();
+                                        return 0;
+                                    }));
+                        for (auto& f : done)
+                            f.get(pool);
+                        return 0;
+                    }).get();
+            });
+    }
+    bench::run("scheduler async x16", opt.iterations / 16, 16, opt,
+               [&](long n) {
+                   async(sched, [n] {
+                           std::vector<future<int> > done;
+                           for (long i = 0; i < n; ++i) {
+                               for (int t = 0; t < 16; ++t)
+                                   done.push_back(async(pool, [] { return 0; }));
+                               for (auto& f : done)
+                                   f.get(pool);
+                               done.clear();
+                           }
+                           return 0;
+                       }).get();
+               });
+    bench::run("scheduler remote post", opt.iterations / 100, 1, opt,
+               [&](long n) {
+                   for (long i = 0; i < n; ++i)
+                       async(sched, [] { return 0; }).get();
+               });
+}
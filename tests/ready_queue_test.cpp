@@ -0,0 +1,118 @@
+#include "ready_queue.hpp"
+#include <cassert>
+#include <vector>
+
+using gpd::ready_queue;
+
+struct item : gpd::node {
+    int id = 0;
+};
+
+int main() {
+    {
+        ready_queue<item, 3> q;
+        assert(q.empty());
+        assert(q.pop() == 0);
+        assert(q.top() == 3);
+        std::vector<item> v(9);
+        for (int i = 0; i < 9; ++i) {
+            v[i].id = i;
+            q.push(&v[i], 2 - i % 3); // classes 2, 1, 0, 2, 1, 0...
+        }
+        assert(q.size() == 9);
+        assert(q.top() == 0);
+        assert(!q.empty(1));
+        // classes in order, FIFO within a class
+        int expected[] = { 2, 5, 8, 1, 4, 7, 0, 3, 6 };
+        for (int id : expected) {
+            item * n = q.pop();
+            assert(n && n->id == id);
+        }
+        assert(q.empty());
+        assert(q.size() == 0);
+    }
+    {
+        // interleaved pushes and pops, a class emptied and refilled
+        ready_queue<item, 2> q;
+        item a, b, c;
+        q.push(&a, 1);
+        q.push(&b, 1);
+        assert(q.pop(0) == 0);
+        assert(q.pop() == &a);
+        q.push(&c, 0);
+        assert(q.top() == 0);
+        assert(q.pop() == &c);
+        assert(q.empty(0) && !q.empty(1));
+        q.push(&a, 1);
+        assert(q.pop(1) == &b);
+        assert(q.pop(1) == &a);
+        assert(q.empty());
+        q.push(&a, 0);
+        assert(q.pop() == &a);
+    }
+    {
+        // tenants in deficit round robin, by weight
+        ready_queue<item, 2, 4> q;
+        assert(q.get_weight(1) == 1);
+        q.set_weight(0, 3);
+        std::vector<item> v(12);
+        for (int i = 0; i < 8; ++i) {
+            v[i].id = i;
+            q.push(&v[i], 1, 0);  // tenant 0 floods
+        }
+        for (int i = 8; i < 11; ++i) {
+            v[i].id = i;
+            q.push(&v[i], 1, 3);
+        }
+        v[11].id = 11;
+        q.push(&v[11], 0, 2); // a higher class still comes first
+        int expected[] = { 11, 0, 1, 2, 8, 3, 4, 5, 9, 6, 7, 10 };
+        for (int id : expected) {
+            item * n = q.pop();
+            assert(n && n->id == id);
+        }
+        assert(q.empty());
+
+        // a tenant emptied loses the rest of its turn
+        q.set_weight(1, 2);
+        q.push(&v[0], 0, 1);
+        q.push(&v[1], 0, 2);
+        assert(q.pop() == &v[0]);
+        q.push(&v[2], 0, 1);
+        assert(q.pop() == &v[1]);
+        assert(q.pop() == &v[2]);
+        assert(q.empty());
+
+        // a tenant charged more than its credit sits out turns until
+        // it has repaid its debt
+        ready_queue<item, 1, 2> r;
+        for (int i = 0; i < 8; ++i)
+            r.push(&v[i], 0, i / 4);
+        assert(r.shared(0));
+        assert(r.pop() == &v[0]);
+        r.charge(0, 0, 2);
+        int charged[] = { 4, 5, 6, 1, 7, 2, 3 };
+        for (int id : charged)
+            assert(r.pop() == &v[id]);
+        assert(r.empty() && !r.shared(0));
+
+        // a huge charge only costs debt_rounds rounds, and is
+        // forgotten once the tenant has no work
+        ready_queue<item, 1, 2> s;
+        std::vector<item> w(16);
+        for (int i = 0; i < 16; ++i)
+            s.push(&w[i], 0, i < 2 ? 0 : 1);
+        assert(s.pop() == &w[0]);
+        s.charge(0, 0, std::int64_t(1) << 40);
+        for (unsigned i = 0; i <= s.debt_rounds; ++i)
+            assert(s.pop() == &w[2 + i]);
+        assert(s.pop() == &w[1]);
+        s.charge(0, 0, std::int64_t(1) << 40);
+        s.push(&w[0], 0, 0);
+        assert(s.pop() == &w[11]);
+        assert(s.pop() == &w[0]);
+        for (int i = 12; i < 16; ++i)
+            assert(s.pop() == &w[i]);
+        assert(s.empty());
+    }
+}
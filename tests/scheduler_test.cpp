@@ -0,0 +1,851 @@
+#include "task.hpp"
+#include "future.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+using namespace gpd;
+
+// keep the worker busy without giving it back to the scheduler
+void burn(std::chrono::microseconds d) {
+    auto end = std::chrono::steady_clock::now() + d;
+    while (std::chrono::steady_clock::now() < end)
+        ;
+}
+
+int main() {
+    {
+        scheduler_pool workers(4);
+        assert(workers.size() == 4);
+    }
+    {
+        // round robin submission from outside the pool
+        scheduler_pool workers(4);
+        std::mutex mux;
+        std::set<std::thread::id> ids;
+        std::vector<future<int> > results;
+        for (int i = 0; i < 64; ++i)
+            results.push_back(async(workers, [&, i] {
+                        yield();
+                        std::lock_guard<std::mutex> _(mux);
+                        ids.insert(std::this_thread::get_id());
+                        return i;
+                    }));
+        for (int i = 0; i < 64; ++i)
+            assert(results[i].get() == i);
+        assert(ids.size() == 4);
+        assert(!ids.count(std::this_thread::get_id()));
+    }
+    {
+        // everything spawned from a single task: idle workers steal
+        scheduler_pool workers(4);
+        std::mutex mux;
+        std::set<std::thread::id> ids;
+        auto root = async(workers[0], [&] {
+                std::vector<future<int> > children;
+                for (int i = 0; i < 64; ++i)
+                    children.push_back(async(pool, [&, i] {
+                                burn(std::chrono::microseconds(500));
+                                yield();
+                                std::lock_guard<std::mutex> _(mux);
+                                ids.insert(std::this_thread::get_id());
+                                return i;
+                            }));
+                int sum = 0;
+                for (auto& c : children)
+                    sum += c.get(pool);
+                return sum;
+            });
+        assert(root.get() == 63 * 64 / 2);
+        assert(ids.size() > 1);
+    }
+    {
+        // nested fan out
+        scheduler_pool workers;
+        auto root = async(workers, [] {
+                std::vector<future<int> > children;
+                for (int i = 0; i < 16; ++i)
+                    children.push_back(async(pool, [] {
+                                std::vector<future<int> > leaves;
+                                for (int j = 0; j < 16; ++j)
+                                    leaves.push_back(async(pool, [] { 
+                                                yield(); 
+                                                return 1; 
+                                            }));
+                                int sum = 0;
+                                for (auto& l : leaves)
+                                    sum += l.get(pool);
+                                return sum;
+                            }));
+                int sum = 0;
+                for (auto& c : children)
+                    sum += c.get(pool);
+                return sum;
+            });
+        assert(root.get() == 256);
+    }
+    {
+        // a worker runs its deque newest first, yet yielding tasks
+        // take turns
+        scheduler_pool workers(1);
+        auto turns = async(workers[0], [] {
+                std::vector<int> log;
+                std::vector<future<int> > tasks;
+                for (int i = 0; i < 3; ++i)
+                    tasks.push_back(async(pool, [&log, i] {
+                                for (int j = 0; j < 4; ++j) {
+                                    log.push_back(i);
+                                    yield();
+                                }
+                                return i;
+                            }));
+                for (auto& t : tasks)
+                    t.get(pool);
+                for (std::size_t k = 3; k < log.size(); ++k)
+                    if (log[k] != log[k - 3])
+                        return false;
+                return log.size() == 12;
+            });
+        assert(turns.get());
+    }
+    {
+        // idle policy: block straight away
+        idle_policy policy;
+        policy.spins = 0;
+        policy.yields = 0;
+        auto& sched = *start_background_scheduler(policy).get();
+        for (int i = 0; i < 10; ++i) {
+            assert(async(sched, [i] { return i; }).get() == i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        auto stats = get_idle_stats(sched);
+        assert(stats.spin == 0 && stats.yield == 0);
+        assert(stats.park > 0);
+    }
+    {
+        // spin for long enough to catch every remote push
+        idle_policy policy;
+        policy.spins = 1u << 30;
+        scheduler_pool workers(1, policy);
+        for (int i = 0; i < 10; ++i) 
+            assert(async(workers, [i] { return i; }).get() == i);
+        auto stats = get_idle_stats(workers[0]);
+        assert(stats.park == 0);
+        assert(stats.spin + stats.yield > 0);
+    }
+    {
+        using namespace std::chrono;
+        auto& sched = *start_background_scheduler().get();
+        // sleeping does not block the scheduler
+        std::atomic<bool> done { false };
+        auto sleeper = async(sched, [&] {
+                auto t0 = steady_clock::now();
+                sleep_for(milliseconds(20));
+                done = true;
+                return steady_clock::now() - t0;
+            });
+        auto spinner = async(sched, [&] {
+                int laps = 0;
+                while (!done) { yield(); ++laps; }
+                return laps;
+            });
+        assert(sleeper.get() >= milliseconds(20));
+        assert(spinner.get() > 0);
+
+        // many sleepers, each wakes up after its own deadline
+        std::vector<future<bool> > sleepers;
+        for (int i = 0; i < 100; ++i)
+            sleepers.push_back(async(sched, [i] {
+                        auto deadline = steady_clock::now() +
+                            microseconds(100 * (i % 37));
+                        sleep_until(deadline);
+                        return steady_clock::now() >= deadline;
+                    }));
+        for (auto& x : sleepers)
+            assert(x.get());
+
+        // time out a wait
+        promise<int> never;
+        auto never_ready = never.get_future();
+        auto timed_out = async(sched, [&] {
+                timer t(milliseconds(5));
+                wait_any(pool, never_ready, t);
+                return t.expired() && !never_ready.ready();
+            });
+        assert(timed_out.get());
+
+        // the event wins, the timer is cancelled
+        auto fast = async(sched, [] { yield(); return 42; });
+        auto not_timed_out = async(sched, [&] {
+                timer t(seconds(60));
+                wait_any(pool, fast, t);
+                return !t.expired() && fast.get(pool) == 42;
+            });
+        assert(not_timed_out.get());
+
+        // a timer armed after a long idle period fires on time, the
+        // scheduler parked once until its deadline (within the first
+        // level of the wheel, which next_deadline() tells exactly)
+        std::this_thread::sleep_for(seconds(2));
+        auto after_idle = async(sched, [&sched] {
+                auto parks = get_stats(sched).parks;
+                auto t0 = steady_clock::now();
+                sleep_for(milliseconds(3));
+                auto slept = steady_clock::now() - t0;
+                return slept >= milliseconds(3) &&
+                    slept < milliseconds(500) &&
+                    get_stats(sched).parks == parks + 1;
+            });
+        assert(after_idle.get());
+    }
+    {
+        // batches posted from outside, from a task of the target and
+        // from a task of another scheduler
+        auto& sched = *start_background_scheduler().get();
+        const int count = 1000;
+        std::vector<int> order;
+        task_batch batch;
+        std::vector<future<int> > done;
+        for (int i = 0; i < count; ++i)
+            done.push_back(async(batch, [&order, i] {
+                        order.push_back(i);
+                        return i;
+                    }));
+        assert(batch.size() == count && order.empty());
+        batch.post(sched);
+        assert(batch.empty());
+        for (int i = 0; i < count; ++i)
+            assert(done[i].get() == i);
+        for (int i = 0; i < count; ++i)
+            assert(order[i] == i);
+
+        auto local = async(sched, [&] {
+                task_batch batch;
+                std::vector<future<int> > done;
+                for (int i = 0; i < count; ++i)
+                    done.push_back(async(batch, [i] { return i; }));
+                batch.post(sched);
+                int sum = 0;
+                for (auto& f : done)
+                    sum += f.get(pool);
+                return sum;
+            });
+        assert(local.get() == count * (count - 1) / 2);
+
+        scheduler_pool workers(2);
+        auto remote = async(workers[0], [&] {
+                task_batch batch;
+                std::vector<future<int> > done;
+                for (int i = 0; i < count; ++i)
+                    done.push_back(async(batch, [i] { return i; }));
+                batch.post(workers[1]);
+                int sum = 0;
+                for (auto& f : done)
+                    sum += f.get(pool);
+                return sum;
+            });
+        assert(remote.get() == count * (count - 1) / 2);
+    }
+    {
+        // runtime counters
+        idle_policy policy;
+        policy.spins = 0;
+        policy.yields = 0;
+        auto& sched = *start_background_scheduler(policy).get();
+        for (int i = 0; i < 10; ++i) {
+            assert(async(sched, [i] { return i; }).get() == i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        auto local = async(sched, [] {
+                for (int i = 0; i < 100; ++i)
+                    yield();
+                return true;
+            });
+        assert(local.get());
+        auto stats = get_stats(sched);
+        assert(stats.remote_pops >= 10);
+        assert(stats.local_pops >= 100);
+        assert(stats.tasks_run == stats.pinned_pops + stats.local_pops +
+               stats.steals);
+        assert(stats.local_pops >= stats.remote_pops);
+        assert(stats.steals == 0);
+        assert(stats.idle_entries > 0 && stats.parks > 0);
+        assert(stats.parked.count() > 0);
+        assert(stats.wakeups > 0);
+        assert(stats.wakeup_syscalls <= stats.wakeups);
+        assert(stats.idle.park > 0);
+        // drained once idle
+        for (int i = 0; ; ++i) {
+            stats = get_stats(sched);
+            if (stats.pinned_depth == 0 && stats.local_depth == 0 &&
+                stats.remote_depth == 0)
+                break;
+            assert(i < 1000);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // periodic reports
+        std::atomic<int> reports { 0 };
+        report_stats(sched, std::chrono::milliseconds(1),
+                     [&] (scheduler_stats const& s) {
+                         assert(s.tasks_run > 0);
+                         return ++reports < 3;
+                     });
+        while (reports < 3)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        // steals show on the thief
+        scheduler_pool workers(2);
+        auto root = async(workers[0], [&] {
+                std::vector<future<int> > children;
+                for (int i = 0; i < 64; ++i)
+                    children.push_back(async(pool, [i] {
+                                burn(std::chrono::microseconds(100));
+                                return i;
+                            }));
+                int sum = 0;
+                for (auto& c : children)
+                    sum += c.get(pool);
+                return sum;
+            });
+        assert(root.get() == 64 * 63 / 2);
+        std::uint64_t run = 0;
+        for (std::size_t i = 0; i < workers.size(); ++i)
+            run += get_stats(workers[i]).tasks_run;
+        assert(run >= 64);
+    }
+    {
+        // run next slot: a task woken up by another task runs ahead
+        // of the queue, but a ping-pong pair cannot starve it
+        auto& sched = *start_background_scheduler().get();
+        auto order = [&] {
+            return async(sched, [] {
+                    std::vector<int> log;
+                    promise<int> p;
+                    auto f = p.get_future();
+                    auto woken = async(pool, [&] {
+                            log.push_back(f.get(pool));
+                            return 0;
+                        });
+                    auto queued = async(pool, [&] {
+                            yield();
+                            log.push_back(1);
+                            return 0;
+                        });
+                    yield(); // both started, 'woken' waits on 'f'
+                    p.set_value(2);
+                    yield();
+                    woken.get(pool);
+                    queued.get(pool);
+                    return log;
+                }).get();
+        };
+        assert((order() == std::vector<int>{1, 2}));
+        set_run_next(sched, 3);
+        assert((order() == std::vector<int>{2, 1}));
+
+        const int rounds = 1000;
+        auto laps = async(sched, [&] {
+                std::vector<promise<int> > to_a(rounds), to_b(rounds);
+                std::vector<future<int> > at_a, at_b;
+                for (int i = 0; i < rounds; ++i) {
+                    at_a.push_back(to_a[i].get_future());
+                    at_b.push_back(to_b[i].get_future());
+                }
+                bool done = false;
+                auto a = async(pool, [&] {
+                        for (int i = 0; i < rounds; ++i) {
+                            to_b[i].set_value(i);
+                            at_a[i].get(pool);
+                        }
+                        done = true;
+                        return 0;
+                    });
+                auto b = async(pool, [&] {
+                        for (int i = 0; i < rounds; ++i) {
+                            at_b[i].get(pool);
+                            to_a[i].set_value(i);
+                        }
+                        return 0;
+                    });
+                int laps = 0;
+                while (!done) {
+                    yield();
+                    ++laps;
+                }
+                a.get(pool);
+                b.get(pool);
+                return laps;
+            });
+        assert(laps.get() >= rounds / 3);
+        set_run_next(sched, 0);
+    }
+    {
+        // task classes: higher classes first, inherited by children
+        auto& sched = *start_background_scheduler().get();
+        auto order = async(sched, [] {
+                std::vector<int> log;
+                auto spawn = [&](task_class cls, int id) {
+                    set_task_class(cls);
+                    return async(pool, [&log, cls, id] {
+                            assert(get_task_class() == cls);
+                            log.push_back(id);
+                            return id;
+                        });
+                };
+                auto b = spawn(task_class::batch, 2);
+                auto n = spawn(task_class::normal, 1);
+                auto l = spawn(task_class::latency, 0);
+                set_task_class(task_class::normal);
+                b.get(pool);
+                n.get(pool);
+                l.get(pool);
+                return log;
+            });
+        assert((order.get() == std::vector<int>{0, 1, 2}));
+        assert(async(sched, [] {
+                    return get_task_class() == task_class::normal;
+                }).get());
+
+        // ... also when posted remotely
+        scheduler_pool workers(2);
+        std::atomic<int> next { 0 };
+        std::atomic<bool> posted { false };
+        auto remote = async(workers[0], [&] {
+                // keep workers[1] busy until everything is queued
+                auto busy = async(workers[1], [&] {
+                        while (!posted)
+                            std::this_thread::yield();
+                        return 0;
+                    });
+                set_task_class(task_class::batch);
+                std::vector<future<int> > done;
+                for (int i = 0; i < 32; ++i)
+                    done.push_back(async(workers[1], [&] {
+                                burn(std::chrono::microseconds(10));
+                                return next++;
+                            }));
+                set_task_class(task_class::latency);
+                auto first = async(workers[1], [&] { return next++; });
+                posted = true;
+                busy.get(pool);
+                int sum = 0;
+                for (auto& f : done)
+                    sum += f.get(pool);
+                return first.get(pool) < 32;
+            });
+        assert(remote.get());
+    }
+    {
+        // tenants: a flood only delays the others by its share
+        auto& sched = *start_background_scheduler().get();
+        auto last = [&](unsigned flood_weight) {
+            set_tenant_weight(sched, 1, flood_weight);
+            return async(sched, [] {
+                    std::vector<unsigned> log;
+                    std::vector<future<int> > done;
+                    auto spawn = [&] {
+                        return async(pool, [&log] {
+                                for (int j = 0; j < 10; ++j) {
+                                    log.push_back(get_tenant());
+                                    yield();
+                                }
+                                return 0;
+                            });
+                    };
+                    set_tenant(1);
+                    for (int i = 0; i < 100; ++i)
+                        done.push_back(spawn());
+                    set_tenant(2);
+                    done.push_back(spawn());
+                    set_tenant(0);
+                    for (auto& f : done)
+                        f.get(pool);
+                    // turns taken before the last of tenant 2
+                    return std::find(log.rbegin(), log.rend(), 2u).base() -
+                        log.begin();
+                }).get();
+        };
+        assert(last(1) < 40);
+        assert(last(4) < 80);
+        set_tenant_weight(sched, 1, 1);
+
+        // tenants are charged for run time, and chosen at submission
+        auto turns = async(sched, [&sched] {
+                std::vector<unsigned> log;
+                std::vector<future<int> > done;
+                auto spawn = [&](unsigned tenant, int slices,
+                                 std::chrono::microseconds busy) {
+                    return async(sched, tenant, [&log, slices, busy] {
+                            for (int j = 0; j < slices; ++j) {
+                                log.push_back(get_tenant());
+                                auto end = std::chrono::steady_clock::now() + busy;
+                                while (std::chrono::steady_clock::now() < end)
+                                    ;
+                                yield();
+                            }
+                            return 0;
+                        });
+                };
+                for (int i = 0; i < 4; ++i)
+                    done.push_back(spawn(1, 10, std::chrono::microseconds(500)));
+                done.push_back(spawn(2, 30, std::chrono::microseconds(0)));
+                assert(get_tenant() == 0);
+                for (auto& f : done)
+                    f.get(pool);
+                auto end = std::find(log.rbegin(), log.rend(), 2u).base();
+                // turns of tenant 1 before the last of tenant 2
+                return std::count(log.begin(), end, 1u);
+            }).get();
+        assert(turns < 15);
+        auto tenant = async(sched, [&sched] {
+                auto inner = async(sched, 3, [] { return get_tenant(); }).get(pool);
+                return inner == 3 && get_tenant() == 0;
+            });
+        assert(tenant.get());
+    }
+    {
+        // task groups: fan-out on the pool and bulk join
+        scheduler_pool workers(4);
+        auto ok = async(workers[0], [&] {
+                task_group group;
+                group.join(); // nothing to wait for
+                std::atomic<int> sum { 0 };
+                for (int i = 1; i <= 500; ++i)
+                    group.spawn(workers, [&sum, i] {
+                            if (i % 3 == 0)
+                                yield();
+                            sum += i;
+                        });
+                group.join();
+                assert(group.size() == 0);
+                int total = sum;
+
+                // reused, children on the current scheduler only
+                for (int i = 0; i < 10; ++i)
+                    group.spawn(pool, [&sum] { sum -= 1; });
+                group.join();
+                return total == 500 * 501 / 2 && sum == total - 10;
+            });
+        assert(ok.get());
+
+        // the first exception is rethrown, every child still runs
+        auto failed = async(workers[1], [&] {
+                task_group group;
+                std::atomic<int> done { 0 };
+                for (int i = 0; i < 50; ++i)
+                    group.spawn(workers, [&done, i] {
+                            ++done;
+                            if (i % 10 == 0)
+                                throw i;
+                        });
+                int caught = -1;
+                try {
+                    group.join();
+                } catch (int i) {
+                    caught = i;
+                }
+                // ... and only once
+                group.join();
+                return caught % 10 == 0 && done == 50;
+            });
+        assert(failed.get());
+    }
+    {
+        // cancellation wakes up waits and yield points
+        using namespace std::chrono;
+        auto& sched = *start_background_scheduler().get();
+        auto cancelled = [](auto f) {
+            try {
+                f();
+            } catch (task_cancelled&) {
+                return true;
+            }
+            return false;
+        };
+        cancellation_token token;
+        promise<int> never, never_either;
+        auto pending = never.get_future();
+        auto other = never_either.get_future();
+        std::atomic<int> waiting { 0 };
+        auto start = steady_clock::now();
+        std::vector<future<bool> > tasks;
+        tasks.push_back(async(sched, [&] {
+                    set_cancellation(&token);
+                    ++waiting;
+                    return cancelled([&] { pending.get(pool); }) &&
+                        pending.valid();
+                }));
+        tasks.push_back(async(sched, [&] {
+                    set_cancellation(&token);
+                    ++waiting;
+                    return cancelled([] { sleep_for(seconds(60)); });
+                }));
+        tasks.push_back(async(sched, [&] {
+                    set_cancellation(&token);
+                    ++waiting;
+                    timer t(seconds(60));
+                    return cancelled([&] { wait_any(pool, t, other); });
+                }));
+        tasks.push_back(async(sched, [&] {
+                    set_cancellation(&token);
+                    ++waiting;
+                    return cancelled([] { while (true) yield(); });
+                }));
+        tasks.push_back(async(sched, [&] {
+                    // inherited by children
+                    set_cancellation(&token);
+                    auto child = async(pool, [&] {
+                            ++waiting;
+                            return cancelled([] { sleep_for(seconds(60)); });
+                        });
+                    auto uncaught = async(pool, [&] {
+                            ++waiting;
+                            sleep_for(seconds(60));
+                            return false;
+                        });
+                    set_cancellation(0);
+                    return child.get(pool) &&
+                        cancelled([&] { uncaught.get(pool); });
+                }));
+        cancellation_token groups;
+        tasks.push_back(async(sched, [&] {
+                    task_group group(groups);
+                    for (int i = 0; i < 100; ++i)
+                        group.spawn(pool, [&] {
+                                ++waiting;
+                                sleep_for(seconds(60));
+                            });
+                    return cancelled([&] { group.join(); });
+                }));
+        while (waiting != 106)
+            std::this_thread::yield();
+        token.cancel();
+        groups.cancel();
+        for (auto& t : tasks)
+            assert(t.get());
+        assert(steady_clock::now() - start < seconds(30));
+
+        // a ready event wins, an early cancellation throws at once
+        assert(async(sched, [&] {
+                    set_cancellation(&token);
+                    timer t(seconds(60));
+                    future<int> ready(1);
+                    wait_any(pool, t, ready);
+                    return ready.ready() && cancelled([&] { wait(pool, t); }) &&
+                        cancelled([] { check_cancellation(); });
+                }).get());
+        assert(async(sched, [] { yield(); return get_cancellation() == 0; }).get());
+    }
+    {
+        // schedulers bound to cpus
+        auto cpus = online_cpus();
+        auto cores = physical_cores();
+        assert(!cores.empty() && cores.size() <= cpus.size());
+        int cpu = cpus.back();
+        auto& bound = *start_background_scheduler(placement{{cpu, cpu}}).get();
+        assert(get_cpus(bound) == std::vector<int>{cpu});
+        assert(async(bound, [] { return ::sched_getcpu(); }).get() == cpu);
+        if (!online_cpus(0).empty()) {
+            auto& node = *start_background_scheduler(placement{{}, 0}).get();
+            assert(get_cpus(node) == online_cpus(0));
+        }
+        assert(get_cpus(*start_background_scheduler().get()).empty());
+
+        // one worker per physical core
+        std::vector<placement> per_core;
+        for (int core : cores)
+            per_core.push_back(placement{{core}});
+        scheduler_pool workers(per_core);
+        assert(workers.size() == cores.size());
+        for (std::size_t i = 0; i < cores.size(); ++i)
+            assert(async(workers[i], [] { return ::sched_getcpu(); }).get()
+                   == cores[i]);
+
+        // invalid placements
+        auto fails = [](auto f) {
+            try {
+                f();
+            } catch (std::system_error&) {
+                return true;
+            }
+            return false;
+        };
+        assert(fails([] { start_background_scheduler(placement{{-1}}).get(); }));
+        assert(fails([] { scheduler_pool bad({placement{}, placement{{-1}}}); }));
+    }
+    {
+        // background schedulers: drained, stopped and unwound
+        using namespace std::chrono;
+        struct counted {
+            std::atomic<int>& count;
+            ~counted() { ++count; }
+        };
+        std::atomic<int> ran { 0 }, started { 0 }, unwound { 0 };
+        {
+            background_scheduler bg;
+            for (int i = 0; i < 100; ++i)
+                async(bg.get(), [&] {
+                        ++ran;
+                        yield();
+                        return ++ran;
+                    });
+            bg.drain();
+            bg.join();
+            assert(ran == 200);
+        }
+        {
+            // draining waits for sleeping tasks and for I/O
+            background_scheduler bg;
+            int fds[2];
+            int ret = ::pipe(fds);
+            assert(ret == 0);
+            auto slept = async(bg.get(), [&] {
+                    sleep_for(milliseconds(20));
+                    return ++ran;
+                });
+            auto read = async(bg.get(), [&] {
+                    char c = 0;
+                    gpd::read(fds[0], &c, 1);
+                    return int(c);
+                });
+            bg.drain();
+            std::this_thread::sleep_for(milliseconds(40));
+            ret = ::write(fds[1], "x", 1);
+            assert(ret == 1);
+            bg.join();
+            assert(slept.get() == 201);
+            assert(read.get() == 'x');
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+        {
+            // a stats reporter does not hold off draining, but keeps
+            // reporting while other sleeping tasks are seen through
+            background_scheduler bg;
+            std::atomic<int> reports { 0 };
+            report_stats(bg.get(), milliseconds(1),
+                         [&] (scheduler_stats const&) {
+                             ++reports;
+                             return true;
+                         });
+            auto slept = async(bg.get(), [&] {
+                    sleep_for(milliseconds(20));
+                    return ++ran;
+                });
+            auto start = steady_clock::now();
+            bg.drain();
+            bg.join();
+            assert(steady_clock::now() - start < seconds(30));
+            assert(slept.get() == 202);
+            assert(reports > 0);
+        }
+        {
+            background_scheduler bg;
+            int fds[2];
+            int ret = ::pipe(fds);
+            assert(ret == 0);
+            std::vector<future<int> > tasks;
+            auto spawn = [&](auto f) {
+                tasks.push_back(async(bg.get(), [&, f] {
+                            counted _ { unwound };
+                            ++started;
+                            f();
+                            return 0;
+                        }));
+            };
+            spawn([] { sleep_for(seconds(60)); });
+            spawn([&] { wait_readable(fds[0]); });
+            spawn([&] { char c; gpd::read(fds[0], &c, 1); });
+            spawn([] { while (true) yield(); });
+            spawn([] { // catch all handlers let the unwinding through
+                    try {
+                        sleep_for(seconds(60));
+                    } catch (...) {
+                        throw;
+                    }
+                });
+            while (started != 5)
+                std::this_thread::yield();
+            auto start = steady_clock::now();
+            bg.stop();
+            bg.join();
+            assert(steady_clock::now() - start < seconds(30));
+            assert(unwound == 5);
+            for (auto& t : tasks)
+                assert(t.has_exception());
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+        {
+            // stopped by the destructor, bound to a cpu
+            background_scheduler bg(placement{{online_cpus().front()}});
+            assert(get_cpus(bg.get()).size() == 1);
+            async(bg.get(), [&] {
+                    counted _ { unwound };
+                    ++started;
+                    sleep_for(seconds(60));
+                    return 0;
+                });
+            while (started != 6)
+                std::this_thread::yield();
+        }
+        assert(unwound == 6);
+    }
+    {
+        // a timer destroyed away from its scheduler
+        using namespace std::chrono;
+        scheduler_pool workers(2);
+        auto moved = async(workers[0], [&] {
+                timer t(seconds(60));
+                yield(workers[1]);
+                return !t.expired();
+            });
+        assert(moved.get());
+    }
+    {
+        // tasks started from a task run on the contexts of finished
+        // ones, suspending and throwing as any other
+        background_scheduler sched;
+        auto ok = async(sched.get(), [] {
+                auto frame = [] {
+                    volatile int x = 0;
+                    return reinterpret_cast<std::uintptr_t>(&x);
+                };
+                auto first = async(pool, frame).get(pool);
+                if (async(pool, frame).get(pool) != first)
+                    return false;
+                for (int round = 0; round < 10; ++round) {
+                    std::vector<future<int> > done;
+                    for (int i = 0; i < 100; ++i)
+                        done.push_back(async(pool, [i] {
+                                    yield();
+                                    if (i % 10 == 0)
+                                        throw std::runtime_error("x");
+                                    return i;
+                                }));
+                    for (int i = 0; i < 100; ++i)
+                        try {
+                            if (done[i].get(pool) != i || i % 10 == 0)
+                                return false;
+                        } catch (std::runtime_error&) {
+                            if (i % 10 != 0)
+                                return false;
+                        }
+                }
+                return true;
+            });
+        assert(ok.get());
+        // the spare contexts are unwound with the scheduler
+        sched.stop();
+        sched.join();
+    }
+}
@@ -0,0 +1,223 @@
+#include "continuation.hpp"
+#include "stack_allocator.hpp"
+#include <vector>
+#include <thread>
+#include <cstring>
+#include <cassert>
+
+using namespace gpd;
+
+// number of resident pages in [p, p + size)
+std::size_t resident(void * p, std::size_t size) {
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> v((size + page - 1) / page);
+    int ret = ::mincore(p, size, v.data());
+    (void)ret;
+    assert(ret == 0);
+    std::size_t count = 0;
+    for (auto x : v) count += x & 1;
+    return count;
+}
+
+template<class C>
+int recurse(C& c, int depth) {
+    volatile char frame[512];
+    frame[0] = depth;
+    if (depth == 0) {
+        c();
+        return frame[0];
+    }
+    return recurse(c, depth - 1) + frame[0];
+}
+
+// static_stack_allocator, remembering the last block it handed out
+struct recording_allocator : static_stack_allocator {
+    static char * block;
+    static std::size_t last;
+
+    static void * allocate(std::size_t size) {
+        last = size;
+        return block = static_cast<char*>
+            (static_stack_allocator::allocate(size));
+    }
+};
+char * recording_allocator::block = 0;
+std::size_t recording_allocator::last = 0;
+
+int main() {
+    {
+        auto c = details::create_continuation<int()>
+            ([](continuation<void(int)> c) {
+                for (int i = 0; i < 10; ++i)
+                    c(i);
+                return c;
+            }, mmap_stack_allocator());
+        int expected = 0;
+        for (auto x : c) 
+            assert(x == expected++);
+        assert(expected == 10);
+    }
+    {
+        // deep frames on a lazily committed stack
+        auto c = details::create_continuation<void()>
+            ([](continuation<void()> c) {
+                recurse(c, 1000);
+                return c;
+            }, mmap_stack_allocator());
+        assert(c);
+        c();
+        assert(!c);
+    }
+    {
+        // many live continuations on small stacks
+        std::vector<continuation<void()> > cs;
+        for (int i = 0; i < 1000; ++i)
+            cs.push_back(details::create_continuation<void()>
+                         ([](continuation<void()> c) {
+                             c();
+                             return c;
+                         }, mmap_stack_allocator(), 64*1024));
+        for (auto& c : cs) {
+            assert(c);
+            c();
+            assert(!c);
+        }
+    }
+    {
+        typedef pooled_stack_allocator<mmap_stack_allocator, 4> alloc;
+        auto make = [] {
+            return details::create_continuation<void()>
+                ([](continuation<void()> c) {
+                    c();
+                    return c;
+                }, alloc(), 64*1024);
+        };
+        for (int i = 0; i < 10; ++i) {
+            auto c = make();
+            c();
+        }
+        auto stats = alloc::stats();
+        assert(stats.misses == 1);
+        assert(stats.hits == 9);
+        assert(stats.high_water == 1);
+
+        // finish on another thread, the stack goes back to this pool
+        auto c = make();
+        std::thread([&] { c(); }).join();
+        assert(!c);
+        auto d = make();
+        stats = alloc::stats();
+        assert(stats.remote_frees == 1);
+        assert(stats.misses == 1);
+        assert(stats.hits == 11);
+        d();
+
+        // freed and allocated during thread exit, after the thread's
+        // pool was released
+        struct late_free {
+            void * p = 0;
+            ~late_free() {
+                alloc::deallocate(p, 64*1024);
+                void * q = alloc::allocate(64*1024);
+                alloc::deallocate(q, 64*1024);
+            }
+        };
+        std::thread([] {
+                static thread_local late_free l;
+                l.p = alloc::allocate(64*1024);
+            }).join();
+    }
+    {
+        // a request that fills its class exactly starts on a page
+        const std::size_t size = 256*1024 - sizeof(details::stack_header);
+        const std::size_t budget = 16*1024;
+        const std::size_t page = ::sysconf(_SC_PAGESIZE);
+        const std::size_t low = (size - budget) & ~(page - 1);
+        typedef pooled_stack_allocator
+            <mmap_stack_allocator, 4, madvise_reclaim<budget> > alloc;
+        char * p = static_cast<char*>(alloc::allocate(size));
+        assert(reinterpret_cast<uintptr_t>(p) % page == 0);
+        std::memset(p, 1, size);
+        assert(resident(p, size) == (size + page - 1) / page);
+        alloc::deallocate(p, size);
+        // nothing is left below the watermark page
+        assert(resident(p, low) == 0);
+        char * q = static_cast<char*>(alloc::allocate(size));
+        assert(p == q);
+        // shallow use: the watermark is intact and nothing is released
+        std::memset(q + size - budget / 2, 1, budget / 2);
+        alloc::deallocate(q, size);
+        assert(resident(q + low, size - low) == 
+               (size - low + page - 1) / page);
+        char * r = static_cast<char*>(alloc::allocate(size));
+        assert(r == q);
+        alloc::deallocate(r, size);
+    }
+    {
+        // blocks are exactly one class large, the header sits right
+        // above the stack and is aligned even with a malloc backed
+        // StackAlloc
+        typedef pooled_stack_allocator<recording_allocator, 4> alloc;
+        char * p = static_cast<char*>(alloc::allocate(64*1024 - 16));
+        assert(recording_allocator::last == 64*1024);
+        alloc::deallocate(p, 64*1024 - 16);
+        char * q = static_cast<char*>(alloc::allocate(64*1024));
+        assert(recording_allocator::last == 128*1024);
+        auto h = alloc::pool::header(q, 64*1024);
+        assert(reinterpret_cast<uintptr_t>(h) % alignof(details::stack_header) == 0);
+        assert(static_cast<void*>(h + 1) == 
+               static_cast<void*>(recording_allocator::block + 128*1024));
+        std::memset(q, 1, 64*1024);
+        alloc::deallocate(q, 64*1024);
+        char * r = static_cast<char*>(alloc::allocate(100*1024));
+        assert(r + 100*1024 == q + 64*1024);
+        alloc::deallocate(r, 100*1024);
+    }
+    {
+        // not page aligned
+        const std::size_t size = 256*1024 + 64;
+        typedef pooled_stack_allocator
+            <static_stack_allocator, 4, madvise_reclaim<16*1024> > alloc;
+        char * p = static_cast<char*>(alloc::allocate(size));
+        std::memset(p, 1, size);
+        alloc::deallocate(p, size);
+        char * q = static_cast<char*>(alloc::allocate(size));
+        assert(p == q);
+        std::memset(q, 2, size);
+        alloc::deallocate(q, size);
+    }
+    {
+        typedef numa_stack_allocator<mmap_stack_allocator, 2*1024*1024> 
+            alloc;
+        auto c = callcc(stack_hint(4*1024*1024, alloc()),
+                        [](continuation<void()> c) {
+                            recurse(c, 1000);
+                            return c;
+                        });
+        assert(c);
+        c();
+        assert(!c);
+    }
+    {
+        for (int depth : { 10, 100, 1000 }) {
+            auto c = callcc(stack_hint(2*1024*1024, 
+                                       profiling_stack_allocator<>("test")),
+                            [depth](continuation<void()> c) {
+                                recurse(c, depth);
+                                return c;
+                            });
+            c();
+        }
+        auto report = stack_usage_report();
+        assert(report.size() == 1);
+        assert(report[0].site == "test");
+        assert(report[0].stacks == 3);
+        assert(report[0].max_depth >= 1000 * 512);
+        assert(report[0].max_depth < 2*1024*1024);
+        std::size_t total = 0;
+        for (auto x : report[0].histogram) total += x;
+        assert(total == 3);
+        reset_stack_usage();
+        assert(stack_usage_report().empty());
+    }
+}
@@ -0,0 +1,108 @@
+#include "continuation.hpp"
+#include "benchmark.hpp"
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace gpd;
+
+#ifdef GPD_INLINE_SWITCH
+static const char * impl = "inline";
+#else
+static const char * impl = "out-of-line";
+#endif
+
+template<class F>
+void measure(const char * name, long switches, F f) {
+    f(switches / 10); // warmup
+    auto t0 = std::chrono::steady_clock::now();
+    auto c0 = bench::rdtsc();
+    f(switches);
+    auto c1 = bench::rdtsc();
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    std::cout << impl << '\t' << name << '\t' 
+              << ns / switches << " ns/switch\t"
+              << double(c1 - c0) / switches << " cycles/switch\n";
+}
+
+// Keep 'N' values live across every switch on both sides.
+template<int N>
+struct pressure {
+    std::uint64_t v[N];
+    explicit pressure(std::uint64_t seed) {
+        for (int i = 0; i < N; ++i) v[i] = seed + i;
+    }
+    __attribute__((always_inline)) void step() {
+        for (int i = 0; i < N; ++i) 
+            v[i] = v[i] * 6364136223846793005ULL + v[(i + 1) % N];
+    }
+    std::uint64_t sum() const {
+        std::uint64_t s = 0;
+        for (int i = 0; i < N; ++i) s ^= v[i];
+        return s;
+    }
+};
+
+volatile std::uint64_t sink;
+
+int main(int argc, char * argv[]) {
+    long count = argc > 1 ? std::atol(argv[1]) : 1000000;
+
+    // latency: ping-pong between two contexts, nothing live
+    measure("ping-pong", 2 * count, [](long n) {
+            auto c = callcc([](continuation<void()> c) {
+                    while (true) c();
+                    return c;
+                });
+            for (long i = 0; i < n / 2; ++i) c();
+        });
+
+    // throughput: round robin over many contexts, cold stacks
+    measure("round-robin", 2 * count, [](long n) {
+            std::vector<continuation<void()> > cs;
+            for (int i = 0; i < 1000; ++i)
+                cs.push_back(callcc(stack_hint(64*1024), 
+                                    [](continuation<void()> c) {
+                                        while (true) c();
+                                        return c;
+                                    }));
+            for (long i = 0; i < n / 2; ++i) cs[i % cs.size()]();
+        });
+
+    // register pressure: both sides keep values live across switches
+    measure("pressure-4", 2 * count, [](long n) {
+            auto c = callcc([](continuation<void()> c) {
+                    pressure<4> p(1);
+                    while (true) { p.step(); c(); sink = p.sum(); }
+                    return c;
+                });
+            pressure<4> p(2);
+            for (long i = 0; i < n / 2; ++i) { p.step(); c(); }
+            sink = p.sum();
+        });
+
+    measure("pressure-12", 2 * count, [](long n) {
+            auto c = callcc([](continuation<void()> c) {
+                    pressure<12> p(1);
+                    while (true) { p.step(); c(); sink = p.sum(); }
+                    return c;
+                });
+            pressure<12> p(2);
+            for (long i = 0; i < n / 2; ++i) { p.step(); c(); }
+            sink = p.sum();
+        });
+
+    // generator: values flow through the switch parameter
+    measure("generator", 2 * count, [](long n) {
+            auto c = callcc([n](continuation<void(long)> c) {
+                    for (long i = 0; i < n / 2; ++i) c(i);
+                    return c;
+                });
+            long sum = 0;
+            for (auto x : c) sum += x;
+            sink = sum;
+        });
+}
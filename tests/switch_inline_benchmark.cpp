@@ -0,0 +1,3 @@
+// Same as switch_benchmark, built with the inline context switch.
+#define GPD_INLINE_SWITCH
+#include "switch_benchmark.cpp"
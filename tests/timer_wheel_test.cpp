@@ -0,0 +1,151 @@
+#include "timer_wheel.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <vector>
+
+using gpd::timer_wheel;
+typedef timer_wheel::clock steady;
+using std::chrono::microseconds;
+
+struct entry : timer_wheel::node {
+    steady::time_point deadline;
+    bool fired = false;
+};
+
+int main() {
+    auto epoch = steady::now();
+    {
+        timer_wheel w(microseconds(100), epoch);
+        assert(w.empty());
+        assert(w.next_deadline() == steady::time_point::max());
+        entry a, b, c;
+        w.add(&a, epoch + microseconds(250)); // rounded up to 300
+        w.add(&b, epoch + microseconds(100));
+        w.add(&c, epoch + microseconds(500));
+        assert(w.size() == 3);
+        assert(w.next_deadline() == epoch + microseconds(100));
+        std::vector<entry*> fired;
+        auto f = [&](timer_wheel::node * n) {
+            fired.push_back(static_cast<entry*>(n));
+        };
+        w.advance(epoch + microseconds(99), f);
+        assert(fired.empty());
+        w.advance(epoch + microseconds(299), f);
+        assert(fired.size() == 1 && fired[0] == &b);
+        assert(w.next_deadline() == epoch + microseconds(300));
+        w.remove(&c);
+        assert(!c.linked());
+        w.advance(epoch + microseconds(1000), f);
+        assert(fired.size() == 2 && fired[1] == &a);
+        assert(w.empty());
+    }
+    {
+        // a timer cascading from level 1 expires before the one
+        // added to level 0 later
+        timer_wheel w(microseconds(100), epoch);
+        entry a, b;
+        w.add(&a, epoch + microseconds(6400)); // tick 64, level 1
+        std::vector<entry*> fired;
+        auto f = [&](timer_wheel::node * n) {
+            fired.push_back(static_cast<entry*>(n));
+        };
+        w.advance(epoch + microseconds(6000), f);
+        assert(fired.empty());
+        w.add(&b, epoch + microseconds(10000)); // tick 100, level 0
+        assert(w.next_deadline() == epoch + microseconds(6400));
+        w.advance(w.next_deadline(), f);
+        assert(fired.size() == 1 && fired[0] == &a);
+        assert(w.next_deadline() == epoch + microseconds(10000));
+    }
+    {
+        // random deadlines across all the levels and beyond, some
+        // cancelled: every timer fires once, in order, never early,
+        // and no later than the tick it falls in.
+        timer_wheel w(microseconds(1), epoch);
+        const int count = 20000;
+        std::vector<entry> entries(count);
+        std::srand(42);
+        for (int i = 0; i < count; ++i) {
+            long us;
+            switch (i % 4) {
+            case 0: us = std::rand() % 64; break;
+            case 1: us = std::rand() % 4096; break;
+            case 2: us = std::rand() % (1 << 20); break;
+            default: us = long(std::rand() % 64) << 24; break;
+            }
+            entries[i].deadline = epoch + microseconds(us);
+            w.add(&entries[i], entries[i].deadline);
+        }
+        for (int i = 0; i < count; i += 7)
+            w.remove(&entries[i]);
+
+        auto now = epoch;
+        auto last = epoch;
+        int fired = 0;
+        while (!w.empty()) {
+            auto next = w.next_deadline();
+            assert(next >= now);
+            now = next;
+            w.advance(now, [&](timer_wheel::node * n) {
+                    auto e = static_cast<entry*>(n);
+                    assert(!e->fired);
+                    assert(e->deadline <= now);
+                    assert(e->deadline > now - microseconds(1));
+                    assert(e->deadline >= last);
+                    last = e->deadline;
+                    e->fired = true;
+                    ++fired;
+                });
+        }
+        for (int i = 0; i < count; ++i)
+            assert(entries[i].fired == (i % 7 != 0));
+        assert(fired == count - (count + 6) / 7);
+    }
+    {
+        // a timer armed after a long idle period: turning the empty
+        // wheel first, as the scheduler does, places it against the
+        // current tick rather than the one of the last advance()
+        using std::chrono::seconds;
+        auto f = [](timer_wheel::node *) {};
+        timer_wheel stale(microseconds(100), epoch);
+        timer_wheel synced(microseconds(100), epoch);
+        auto now = epoch + seconds(10);
+        entry a, b;
+        stale.add(&a, now + microseconds(3000));
+        assert(stale.next_deadline() < now);
+        synced.advance(now, f);
+        synced.add(&b, now + microseconds(3000));
+        assert(synced.next_deadline() == now + microseconds(3000));
+        int fired = 0;
+        synced.advance(now + microseconds(2999), [&](timer_wheel::node *) {
+                ++fired;
+            });
+        assert(fired == 0);
+        synced.advance(now + microseconds(3000), [&](timer_wheel::node * n) {
+                assert(n == &b);
+                ++fired;
+            });
+        assert(fired == 1 && synced.empty());
+        stale.remove(&a);
+    }
+    {
+        // clear, at every level
+        timer_wheel w(microseconds(100), epoch);
+        std::vector<entry> entries(4);
+        long us = 50;
+        for (auto& e : entries) {
+            w.add(&e, epoch + microseconds(us));
+            us *= 64;
+        }
+        int cleared = 0;
+        w.clear([&](timer_wheel::node * n) {
+                assert(!n->linked());
+                static_cast<entry*>(n)->fired = true;
+                ++cleared;
+            });
+        assert(cleared == 4 && w.empty());
+        assert(w.next_deadline() == steady::time_point::max());
+        for (auto& e : entries)
+            assert(e.fired);
+    }
+}
@@ -0,0 +1,258 @@
+#include "task.hpp"
+#include "future.hpp"
+#include "uring.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace gpd;
+
+// read exactly 'size' bytes through gpd::read
+bool read_all(int fd, char * buf, std::size_t size) {
+    while (size) {
+        auto ret = gpd::read(fd, buf, size);
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool write_all(int fd, const char * buf, std::size_t size) {
+    while (size) {
+        auto ret = gpd::write(fd, buf, size);
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+int main() {
+    auto& sched = *start_background_scheduler().get();
+    {
+        // echo over a socket pair, blocking descriptors; the payload
+        // exceeds the socket buffers
+        int fds[2];
+        int ret = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        assert(ret == 0);
+        const std::size_t size = 1 << 20;
+        auto server = async(sched, [fd = fds[1], size] {
+                std::string buf(64 * 1024, 0);
+                std::size_t total = 0;
+                while (total < size) {
+                    auto n = std::min(buf.size(), size - total);
+                    if (!read_all(fd, &buf[0], n) ||
+                        !write_all(fd, buf.data(), n))
+                        break;
+                    total += n;
+                }
+                return total;
+            });
+        auto client = async(sched, [fd = fds[0], size] {
+                std::string out(size, 0), in(size, 0);
+                for (std::size_t i = 0; i < size; ++i)
+                    out[i] = char(i * 7);
+                auto writer = async(pool, [&] {
+                        return write_all(fd, out.data(), size);
+                    });
+                bool ok = read_all(fd, &in[0], size);
+                return writer.get(pool) && ok && in == out;
+            });
+        assert(server.get() == size);
+        assert(client.get());
+
+        // peer closed
+        ::close(fds[1]);
+        auto eof = async(sched, [fd = fds[0]] {
+                char c;
+                return gpd::read(fd, &c, 1) == 0;
+            });
+        assert(eof.get());
+        ::close(fds[0]);
+    }
+    {
+        // non blocking descriptors are retried once ready
+        int fds[2];
+        int ret = ::pipe2(fds, O_NONBLOCK);
+        assert(ret == 0);
+        auto reader = async(sched, [fd = fds[0]] {
+                char c = 0;
+                auto ret = gpd::read(fd, &c, 1);
+                return ret == 1 ? c : 0;
+            });
+        auto writer = async(sched, [fd = fds[1]] {
+                sleep_for(std::chrono::milliseconds(2));
+                return gpd::write(fd, "x", 1) == 1;
+            });
+        assert(writer.get());
+        assert(reader.get() == 'x');
+
+        // errors are reported through errno
+        auto bad = async(sched, [fd = fds[1]] {
+                char c;
+                return gpd::read(fd, &c, 1) == -1 && errno == EBADF;
+            });
+        assert(bad.get());
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+    {
+        // positioned writes, fsync and positioned reads on a file
+        char name[] = "/tmp/uring_testXXXXXX";
+        int fd = ::mkstemp(name);
+        assert(fd != -1);
+        ::unlink(name);
+        auto ok = async(sched, [fd] {
+                if (gpd::write(fd, "world", 5, 6) != 5 ||
+                    gpd::write(fd, "hello ", 6, 0) != 6 ||
+                    gpd::fsync(fd) != 0)
+                    return false;
+                char buf[16] = {};
+                return gpd::read(fd, buf, sizeof(buf), 0) == 11 &&
+                    std::strcmp(buf, "hello world") == 0 &&
+                    gpd::read(fd, buf, 5, 6) == 5;
+            });
+        assert(ok.get());
+        ::close(fd);
+    }
+    {
+        // loopback accept and connect
+        int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        assert(listener != -1);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(listener, (sockaddr*)&addr, len) == 0 &&
+            ::listen(listener, 16) == 0 &&
+            ::getsockname(listener, (sockaddr*)&addr, &len) == 0) {
+            auto server = async(sched, [listener] {
+                    int fd = gpd::accept(listener);
+                    if (fd == -1)
+                        return 0;
+                    char c = 0;
+                    gpd::read(fd, &c, 1);
+                    ::close(fd);
+                    return int(c);
+                });
+            auto client = async(sched, [addr] {
+                    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                    bool ok = gpd::connect(fd, (const sockaddr*)&addr,
+                                           sizeof(addr)) == 0 &&
+                        gpd::write(fd, "y", 1) == 1;
+                    ::close(fd);
+                    return ok;
+                });
+            assert(client.get());
+            assert(server.get() == 'y');
+        }
+        ::close(listener);
+    }
+    {
+        // many tasks in flight at once, more than the ring holds
+        const int count = 300;
+        std::vector<int> fds(2 * count);
+        for (int i = 0; i < count; ++i) {
+            int ret = ::pipe(&fds[2 * i]);
+            assert(ret == 0);
+        }
+        std::vector<future<int> > readers;
+        for (int i = 0; i < count; ++i)
+            readers.push_back(async(sched, [fd = fds[2 * i]] {
+                        int x = -1;
+                        return gpd::read(fd, &x, sizeof(x)) == sizeof(x) ?
+                            x : -1;
+                    }));
+        auto writers = async(sched, [&] {
+                for (int i = 0; i < count; ++i)
+                    if (gpd::write(fds[2 * i + 1], &i, sizeof(i)) != sizeof(i))
+                        return false;
+                return true;
+            });
+        assert(writers.get());
+        for (int i = 0; i < count; ++i)
+            assert(readers[i].get() == i);
+        for (auto fd : fds)
+            ::close(fd);
+    }
+    {
+        // a ring full of blocked operations still has room to be
+        // woken up and cancelled
+        uring ring(4);
+        if (ring.valid()) {
+            int fds[2];
+            int ret = ::pipe(fds);
+            assert(ret == 0);
+            char buf[8][1];
+            unsigned queued = 0;
+            while (auto sqe = ring.get_sqe()) {
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fds[0];
+                sqe->addr = reinterpret_cast<std::uint64_t>(buf[queued]);
+                sqe->len = 1;
+                sqe->user_data = queued + 16;
+                ring.submit();
+                ++queued;
+            }
+            assert(queued > 0 && queued <= 8 - uring::reserved);
+            std::thread waker([&] {
+                    while (!ring.notify())
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                });
+            auto start = uring::clock::now();
+            ring.wait(start + std::chrono::seconds(5), [] { return true; });
+            waker.join();
+            assert(uring::clock::now() - start < std::chrono::seconds(2));
+            assert(ring.cancel_all());
+            unsigned cancelled = 0;
+            while (ring.outstanding() &&
+                   uring::clock::now() - start < std::chrono::seconds(5)) {
+                ring.wait(uring::clock::now() + std::chrono::milliseconds(100),
+                          [] { return true; });
+                ring.reap([&](io_uring_cqe const& cqe) {
+                        assert(cqe.res == -ECANCELED);
+                        ++cancelled;
+                    });
+            }
+            assert(cancelled == queued);
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+    }
+    {
+        // tasks posted from another thread run while every operation
+        // the scheduler ring holds is blocked: 512 reads fill the
+        // completion queue of its default size
+        const int count = 512;
+        int fds[2];
+        int ret = ::pipe(fds);
+        assert(ret == 0);
+        std::vector<future<int> > readers;
+        for (int i = 0; i < count; ++i)
+            readers.push_back(async(sched, [fd = fds[0]] {
+                        char c = 0;
+                        return gpd::read(fd, &c, 1) == 1 ? c : -1;
+                    }));
+        // let the readers block
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(async(sched, [] { return 42; }).get() == 42);
+        std::string data(count, 'x');
+        ret = ::write(fds[1], data.data(), count);
+        assert(ret == count);
+        for (auto& r : readers)
+            assert(r.get() == 'x');
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+}
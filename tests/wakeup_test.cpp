@@ -0,0 +1,86 @@
+#include "task.hpp"
+#include "future.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace gpd;
+
+/**
+ * Wake up stress test: many threads post to a scheduler that parks as
+ * soon as it runs out of work, so that most posts race against it
+ * going to sleep. A lost wake up shows as a post never run.
+ **/
+
+const int producers = 8;
+const int rounds = 2000;
+
+void stress(scheduler& sched) {
+    std::atomic<int> done { 0 };
+    std::vector<std::thread> threads;
+    for (int id = 0; id < producers; ++id)
+        threads.emplace_back([&, id] {
+                for (int i = 0; i < rounds; ++i) {
+                    if (i % 16 == 0) {
+                        task_batch batch;
+                        for (int j = 0; j < 4; ++j)
+                            async(batch, [&] { return ++done; });
+                        batch.post(sched);
+                        i += 3;
+                    } else if ((i + id) % 7 == 0)
+                        // wait, so that the scheduler goes idle
+                        async(sched, [&] { return ++done; }).get();
+                    else
+                        async(sched, [&] { return ++done; });
+                }
+            });
+    for (auto& th : threads)
+        th.join();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (done != producers * rounds) {
+        assert(std::chrono::steady_clock::now() < deadline);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int main() {
+    idle_policy policy;
+    policy.spins = 0;
+    policy.yields = 0;
+    auto& sched = *start_background_scheduler(policy).get();
+
+    // parked on the futex
+    stress(sched);
+
+    // parked in epoll, with a descriptor waited for
+    int fds[2];
+    int ret = ::pipe(fds);
+    assert(ret == 0);
+    auto readable = async(sched, [fd = fds[0]] {
+            wait_readable(fd);
+            return true;
+        });
+    stress(sched);
+
+    // parked in io_uring, with a read in flight
+    int ring_fds[2];
+    ret = ::pipe(ring_fds);
+    assert(ret == 0);
+    auto read = async(sched, [fd = ring_fds[0]] {
+            char c = 0;
+            return gpd::read(fd, &c, 1) == 1 && c == 'x';
+        });
+    stress(sched);
+
+    ret = ::write(ring_fds[1], "x", 1);
+    assert(ret == 1);
+    assert(read.get());
+    ret = ::write(fds[1], "x", 1);
+    assert(ret == 1);
+    assert(readable.get());
+    for (int fd : { fds[0], fds[1], ring_fds[0], ring_fds[1] })
+        ::close(fd);
+}
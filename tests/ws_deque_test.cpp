@@ -0,0 +1,54 @@
+#include "ws_deque.hpp"
+#include <cassert>
+#include <thread>
+#include <vector>
+
+using gpd::ws_deque;
+
+int main() {
+    {
+        ws_deque<int> q(2);
+        int v[1000];
+        assert(q.empty());
+        assert(q.pop() == 0);
+        assert(q.steal() == 0);
+        for (int i = 0; i < 1000; ++i) q.push(&v[i]);  // grows
+        assert(!q.empty());
+        assert(q.steal() == &v[0]);
+        assert(q.pop() == &v[999]);
+        for (int i = 1; i < 500; ++i) assert(q.steal() == &v[i]);
+        for (int i = 998; i >= 500; --i) assert(q.pop() == &v[i]);
+        assert(q.empty());
+        assert(q.pop() == 0);
+        assert(q.steal() == 0);
+    }
+    {
+        // every element is taken exactly once, by the owner or by a
+        // thief
+        static const int count = 1000000;
+        static const int thieves = 3;
+        ws_deque<int> q(16);
+        std::vector<int> v(count, 0);
+        std::vector<std::atomic<int> > taken(count);
+        for (auto& x : taken) x = 0;
+        std::atomic<bool> done { false };
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thieves; ++i)
+            threads.emplace_back([&] {
+                    while (!done) 
+                        if (auto p = q.steal()) 
+                            taken[p - &v[0]]++;
+                });
+        for (int i = 0; i < count; ++i) {
+            q.push(&v[i]);
+            if (i % 3 == 0)
+                if (auto p = q.pop()) 
+                    taken[p - &v[0]]++;
+        }
+        while (auto p = q.pop()) 
+            taken[p - &v[0]]++;
+        done = true;
+        for (auto& t : threads) t.join();
+        for (auto& x : taken) assert(x == 1);
+    }
+}
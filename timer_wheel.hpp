@@ -0,0 +1,205 @@
+#ifndef GPD_TIMER_WHEEL_HPP
+#define GPD_TIMER_WHEEL_HPP
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cassert>
+
+namespace gpd {
+
+/**
+ * Hierarchical timer wheel, after Varghese and Lauck.
+ *
+ * Four levels of 64 slots; a slot at level 'l' spans 64^l ticks. A
+ * timer is put at the lowest level whose span covers its distance
+ * from the current tick and moved down (cascaded) as the wheel turns,
+ * so insertion and removal are O(1) and every timer is moved at most
+ * once per level. Timers beyond the top level are parked in its
+ * farthest slot and re-inserted when it cascades.
+ *
+ * Deadlines are rounded up to the next tick, so timers never expire
+ * early. Not thread safe.
+ **/
+struct timer_wheel {
+    typedef std::chrono::steady_clock clock;
+
+    struct node {
+        node() : next(0), pprev(0) {}
+        node(const node&) = delete;
+        bool linked() const { return pprev; }
+    private:
+        friend struct timer_wheel;
+        std::uint64_t expiry;
+        node * next;
+        node ** pprev;
+        unsigned char level;
+        unsigned char slot;
+    };
+
+    explicit timer_wheel(clock::duration resolution =
+                         std::chrono::microseconds(100),
+                         clock::time_point epoch = clock::now())
+        : resolution(resolution), epoch(epoch), current(0), count(0) {
+        for (auto& l : slots)
+            for (auto& s : l) s = 0;
+        for (auto& o : occupied) o = 0;
+    }
+
+    timer_wheel(const timer_wheel&) = delete;
+
+    /// Pre: !n->linked()
+    void add(node * n, clock::time_point deadline) {
+        assert(!n->linked());
+        auto d = deadline - epoch;
+        n->expiry = d <= clock::duration::zero() ? 0 :
+            std::uint64_t((d + resolution - clock::duration(1)) / resolution);
+        insert(n);
+        ++count;
+    }
+
+    /// Pre: n->linked()
+    void remove(node * n) {
+        assert(n->linked());
+        unlink(n);
+        --count;
+    }
+
+    bool empty() const { return count == 0; }
+
+    std::size_t size() const { return count; }
+
+    /// Turn the wheel up to 'now', calling f(node*) for every timer
+    /// expired, in deadline order (at tick resolution). The node is
+    /// unlinked before the call; f can add and remove timers.
+    template<class F>
+    void advance(clock::time_point now, F&& f) {
+        auto d = now - epoch;
+        std::uint64_t target = d <= clock::duration::zero() ? 0 :
+            std::uint64_t(d / resolution);
+        expire(f);
+        while (current < target) {
+            if (count == 0) {
+                current = target;
+                break;
+            }
+            // skip ahead to the next cascade if level 0 is empty
+            current = occupied[0] ? current + 1 :
+                std::min(target, (current | (slot_count - 1)) + 1);
+            if ((current & (slot_count - 1)) == 0)
+                cascade(1);
+            expire(f);
+        }
+    }
+
+    /// Remove every timer, calling f(node*) for each, in no
+    /// particular order. The node is unlinked before the call; f must
+    /// not add timers.
+    template<class F>
+    void clear(F&& f) {
+        for (auto& level : slots)
+            for (auto& head : level)
+                while (node * n = head) {
+                    unlink(n);
+                    --count;
+                    f(n);
+                }
+    }
+
+    /// The earliest time advance() might have something to do, or
+    /// clock::time_point::max() if empty. Exact if the earliest
+    /// timer expires before the next cascade, a lower bound (the
+    /// cascade) otherwise.
+    clock::time_point next_deadline() const {
+        if (count == 0)
+            return clock::time_point::max();
+        // the higher levels might cascade a timer expiring before
+        // those at level 0
+        std::uint64_t tick = ~std::uint64_t(0);
+        for (unsigned l = 1; l < levels; ++l)
+            if (occupied[l]) {
+                tick = (current | (slot_count - 1)) + 1;
+                break;
+            }
+        if (occupied[0]) {
+            unsigned idx = current & (slot_count - 1);
+            // rotate so that the current slot is bit 0
+            std::uint64_t rot = (occupied[0] >> idx) |
+                (idx ? occupied[0] << (slot_count - idx) : 0);
+            tick = std::min<std::uint64_t>
+                (tick, current + __builtin_ctzll(rot));
+        }
+        return epoch + resolution * tick;
+    }
+
+private:
+    static const unsigned levels = 4;
+    static const unsigned bits = 6;
+    static const unsigned slot_count = 1u << bits;
+
+    void insert(node * n) {
+        std::uint64_t delta = n->expiry > current ? n->expiry - current : 0;
+        unsigned level = 0;
+        while (level + 1 < levels &&
+               delta >= (std::uint64_t(1) << (bits * (level + 1))))
+            ++level;
+        std::uint64_t e = n->expiry > current ? n->expiry : current;
+        if (delta >= (std::uint64_t(1) << (bits * levels)))
+            e = current + ((slot_count - 1) << (bits * (levels - 1)));
+        unsigned slot = (e >> (bits * level)) & (slot_count - 1);
+        node ** head = &slots[level][slot];
+        n->level = level;
+        n->slot = slot;
+        n->next = *head;
+        if (n->next) n->next->pprev = &n->next;
+        n->pprev = head;
+        *head = n;
+        occupied[level] |= std::uint64_t(1) << slot;
+    }
+
+    void unlink(node * n) {
+        *n->pprev = n->next;
+        if (n->next) n->next->pprev = n->pprev;
+        if (!slots[n->level][n->slot])
+            occupied[n->level] &= ~(std::uint64_t(1) << n->slot);
+        n->next = 0;
+        n->pprev = 0;
+    }
+
+    // Move the current slot of 'level' down, higher levels first.
+    void cascade(unsigned level) {
+        if (level == levels)
+            return;
+        unsigned slot = (current >> (bits * level)) & (slot_count - 1);
+        if (slot == 0)
+            cascade(level + 1);
+        node * n = slots[level][slot];
+        slots[level][slot] = 0;
+        occupied[level] &= ~(std::uint64_t(1) << slot);
+        while (n) {
+            node * next = n->next;
+            insert(n);
+            n = next;
+        }
+    }
+
+    template<class F>
+    void expire(F& f) {
+        unsigned slot = current & (slot_count - 1);
+        while (node * n = slots[0][slot]) {
+            assert(n->expiry <= current);
+            unlink(n);
+            --count;
+            f(n);
+        }
+    }
+
+    clock::duration resolution;
+    clock::time_point epoch;
+    std::uint64_t current;
+    std::size_t count;
+    std::uint64_t occupied[levels];
+    node * slots[levels][slot_count];
+};
+
+}
+#endif
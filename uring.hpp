@@ -0,0 +1,308 @@
+#ifndef GPD_URING_HPP
+#define GPD_URING_HPP
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+namespace gpd {
+
+namespace details {
+inline int sys_io_uring_setup(unsigned entries, io_uring_params * p) {
+    return int(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+inline int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags,
+                              void * arg, std::size_t argsz) {
+    return int(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, arg, argsz));
+}
+}
+
+/**
+ * Minimal io_uring submission and completion ring, on top of the raw
+ * system calls.
+ *
+ * Submission entries are only handed to the kernel by submit() or
+ * wait(), so that every entry queued in between goes in a single
+ * io_uring_enter. The number of operations in flight is capped to
+ * the completion queue size, so completions are never dropped, and
+ * those queued via get_sqe() to 'reserved' entries less, so that the
+ * internal notify, poll and cancel entries always fit.
+ *
+ * Everything but notify() must be called by the owner thread. A
+ * ring that failed to set up (older kernels, io_uring disabled) is
+ * !valid() and hands out no entries.
+ **/
+struct uring {
+    typedef std::chrono::steady_clock clock;
+
+    /// user_data values reserved for internal use; never valid
+    /// pointers
+    enum : std::uint64_t { notify_tag = 1, poll_tag = 2, cancel_tag = 3 };
+
+    /// Entries kept for the internal operations, one per tag.
+    static constexpr unsigned reserved = 3;
+
+    explicit uring(unsigned entries = 256)
+        : fd(-1), evfd(-1), notify_armed(false), poll_armed(false),
+          in_flight(0), blocked(false) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = details::sys_io_uring_setup(entries, &p);
+        if (fd == -1)
+            return;
+        if (!(p.features & IORING_FEAT_EXT_ARG)) {
+            ::close(fd);
+            fd = -1;
+            return;
+        }
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        sq_ring = map(sq_size, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : map(cq_size, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)map(p.sq_entries * sizeof(io_uring_sqe),
+                                  IORING_OFF_SQES);
+        sqe_count = p.sq_entries;
+        cqe_count = p.cq_entries;
+        if (!sq_ring || !cq_ring || !sqes) {
+            release();
+            return;
+        }
+        sq_head  = at<std::atomic<unsigned> >(sq_ring, p.sq_off.head);
+        sq_tail  = at<std::atomic<unsigned> >(sq_ring, p.sq_off.tail);
+        sq_mask  = *at<unsigned>(sq_ring, p.sq_off.ring_mask);
+        sq_array = at<unsigned>(sq_ring, p.sq_off.array);
+        cq_head  = at<std::atomic<unsigned> >(cq_ring, p.cq_off.head);
+        cq_tail  = at<std::atomic<unsigned> >(cq_ring, p.cq_off.tail);
+        cq_mask  = *at<unsigned>(cq_ring, p.cq_off.ring_mask);
+        cqes     = at<io_uring_cqe>(cq_ring, p.cq_off.cqes);
+        local_tail = submitted = sq_tail->load(std::memory_order_relaxed);
+        evfd = ::eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    }
+
+    uring(const uring&) = delete;
+
+    ~uring() { release(); }
+
+    bool valid() const { return fd != -1; }
+
+    /// A zeroed submission entry, or null if the ring is full: the
+    /// caller should let the owner thread run wait() or submit() and
+    /// retry.
+    io_uring_sqe * get_sqe() {
+        return acquire(reserved);
+    }
+
+    /// Entries queued but not yet submitted.
+    unsigned pending() const { return local_tail - submitted; }
+
+    /// Operations queued via get_sqe() and not yet reaped.
+    unsigned outstanding() const {
+        return in_flight + pending() - notify_armed - poll_armed;
+    }
+
+    /// Hand the queued entries to the kernel. Return the number
+    /// submitted.
+    unsigned submit() {
+        return enter(0, 0, 0);
+    }
+
+    /// Call f(cqe) for every completion of an operation queued via
+    /// get_sqe(). Return their count.
+    template<class F>
+    unsigned reap(F&& f) {
+        unsigned head = cq_head->load(std::memory_order_relaxed);
+        unsigned tail = cq_tail->load(std::memory_order_acquire);
+        unsigned count = 0;
+        for (; head != tail; ++head) {
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            cq_head->store(head + 1, std::memory_order_release);
+            --in_flight;
+            if (cqe.user_data == notify_tag) {
+                notify_armed = false;
+                std::uint64_t buf;
+                while (::read(evfd, &buf, sizeof(buf)) > 0)
+                    ;
+                continue;
+            }
+            if (cqe.user_data == poll_tag) {
+                poll_armed = false;
+                continue;
+            }
+            if (cqe.user_data == cancel_tag)
+                continue;
+            ++count;
+            f(cqe);
+        }
+        return count;
+    }
+
+    /// Ask the kernel to cancel every operation in flight; they
+    /// complete with -ECANCELED, unless already done. Return false if
+    /// unsupported by the kernel headers or the ring is full.
+    bool cancel_all() {
+#ifdef IORING_ASYNC_CANCEL_ANY
+        if (auto sqe = acquire(0)) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL|IORING_ASYNC_CANCEL_ANY;
+            sqe->user_data = cancel_tag;
+            submit();
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    /// Submit, then block until at least a completion, notify(), or
+    /// 'deadline', unless block() returns false once the ring is
+    /// marked as blocked. If 'poll' is a descriptor, also wake up
+    /// once it is readable.
+    template<class Pred>
+    void wait(clock::time_point deadline, Pred&& block, int poll = -1) {
+        if (!notify_armed && evfd != -1)
+            if (auto sqe = acquire(0)) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = evfd;
+                sqe->poll32_events = POLLIN;
+                sqe->user_data = notify_tag;
+                notify_armed = true;
+            }
+        if (poll != -1 && !poll_armed)
+            if (auto sqe = acquire(0)) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = poll;
+                sqe->poll32_events = POLLIN;
+                sqe->user_data = poll_tag;
+                poll_armed = true;
+            }
+        blocked.store(true); // seq_cst, pairs with notify
+        if (!block()) {
+            blocked.store(false, std::memory_order_relaxed);
+            submit();
+            return;
+        }
+        __kernel_timespec ts = { 0, 0 };
+        __kernel_timespec * tsp = 0;
+        if (deadline != clock::time_point::max()) {
+            auto left = std::max(deadline - clock::now(),
+                                 clock::duration::zero());
+            auto sec = std::chrono::duration_cast<std::chrono::seconds>(left);
+            ts.tv_sec = sec.count();
+            ts.tv_nsec = (left - sec).count();
+            tsp = &ts;
+        }
+        enter(1, IORING_ENTER_GETEVENTS, tsp);
+        blocked.store(false, std::memory_order_relaxed);
+    }
+
+    /// Any thread. Wake up a blocked wait. Return true if it had to.
+    bool notify() {
+        if (!blocked.load() || evfd == -1)
+            return false;
+        std::uint64_t buf = 1;
+        while (::write(evfd, &buf, sizeof(buf)) == -1 && errno == EINTR)
+            ;
+        return true;
+    }
+
+private:
+    template<class T>
+    static T * at(void * base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    // A zeroed entry, unless fewer than 'reserve' would be left.
+    io_uring_sqe * acquire(unsigned reserve) {
+        if (!valid() || in_flight + pending() + reserve >= cqe_count ||
+            local_tail - sq_head->load(std::memory_order_acquire) + reserve
+            >= sqe_count)
+            return 0;
+        unsigned idx = local_tail++ & sq_mask;
+        sq_array[idx] = idx;
+        std::memset(&sqes[idx], 0, sizeof(io_uring_sqe));
+        return &sqes[idx];
+    }
+
+    void * map(std::size_t size, off_t offset) {
+        void * p = ::mmap(0, size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, fd, offset);
+        return p == MAP_FAILED ? 0 : p;
+    }
+
+    unsigned enter(unsigned min_complete, unsigned flags,
+                   __kernel_timespec * ts) {
+        unsigned to_submit = pending();
+        if (!to_submit && !min_complete)
+            return 0;
+        sq_tail->store(local_tail, std::memory_order_release);
+        io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<std::uint64_t>(ts);
+        int ret = details::sys_io_uring_enter
+            (fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG,
+             &arg, sizeof(arg));
+        // on failure nothing was submitted: the entries stay in the
+        // ring for the next call
+        unsigned done = ret > 0 ? unsigned(ret) : 0;
+        submitted += done;
+        in_flight += done;
+        return done;
+    }
+
+    void release() {
+        if (sqes) ::munmap(sqes, sqe_count * sizeof(io_uring_sqe));
+        if (cq_ring && cq_ring != sq_ring) ::munmap(cq_ring, cq_size);
+        if (sq_ring) ::munmap(sq_ring, sq_size);
+        sqes = 0;
+        cq_ring = sq_ring = 0;
+        if (evfd != -1) ::close(evfd);
+        if (fd != -1) ::close(fd);
+        fd = evfd = -1;
+    }
+
+    int fd;
+    int evfd;
+    bool notify_armed;
+    bool poll_armed;
+    bool single_mmap = false;
+    unsigned in_flight;
+    unsigned sqe_count = 0;
+    unsigned cqe_count = 0;
+    std::size_t sq_size = 0;
+    std::size_t cq_size = 0;
+    void * sq_ring = 0;
+    void * cq_ring = 0;
+    io_uring_sqe * sqes = 0;
+
+    std::atomic<unsigned> * sq_head = 0;
+    std::atomic<unsigned> * sq_tail = 0;
+    unsigned sq_mask = 0;
+    unsigned * sq_array = 0;
+    std::atomic<unsigned> * cq_head = 0;
+    std::atomic<unsigned> * cq_tail = 0;
+    unsigned cq_mask = 0;
+    io_uring_cqe * cqes = 0;
+
+    unsigned local_tail = 0;
+    unsigned submitted = 0;
+
+    std::atomic<bool> blocked;
+};
+
+}
+#endif
@@ -0,0 +1,137 @@
+#ifndef GPD_WS_DEQUE_HPP
+#define GPD_WS_DEQUE_HPP
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gpd {
+
+/**
+ * Work stealing deque, based on the algorithm by Chase and Lev, with
+ * the memory orderings from "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (Lê, Pop, Cohen, Zappa Nardelli).
+ *
+ * The owner thread pushes and pops at the bottom, any thread can
+ * steal from the top. Holds pointers; ownership of the pointees is
+ * not managed.
+ *
+ * The circular buffer grows as needed and never shrinks. Buffers
+ * outgrown are only released on destruction, as a concurrent thief
+ * might still be reading from them.
+ **/
+template<class T>
+struct ws_deque {
+    explicit ws_deque(std::size_t initial_size = 256)
+        : m_top(0), m_bottom(0) {
+        std::size_t size = 1;
+        while (size < initial_size) size *= 2;
+        m_buffers.emplace_back(new buffer(size));
+        m_array.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    ws_deque(const ws_deque&) = delete;
+
+    /// Owner only.
+    void push(T* x) {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        auto a = m_array.load(std::memory_order_relaxed);
+        if (b - t > std::int64_t(a->mask))
+            a = grow(a, t, b);
+        a->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// Owner only. Return the most recently pushed element, or null
+    /// if empty.
+    T* pop() {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        auto a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+        T* x = 0;
+        if (t <= b) {
+            x = a->get(b);
+            if (t == b) {
+                // last element, race against thieves
+                if (!m_top.compare_exchange_strong
+                    (t, t + 1, std::memory_order_seq_cst,
+                     std::memory_order_relaxed))
+                    x = 0;
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        return x;
+    }
+
+    /// Any thread, the owner included. Return the least recently
+    /// pushed element, or null if empty or if the race for it was
+    /// lost.
+    T* steal() {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+        if (t < b) {
+            auto a = m_array.load(std::memory_order_acquire);
+            T* x = a->get(t);
+            if (m_top.compare_exchange_strong
+                (t, t + 1, std::memory_order_seq_cst,
+                 std::memory_order_relaxed))
+                return x;
+        }
+        return 0;
+    }
+
+    /// Approximate, unless called by the owner with no thieves around.
+    std::size_t size() const {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_relaxed);
+        return b > t ? std::size_t(b - t) : 0;
+    }
+
+    /// Approximate, unless called by the owner with no thieves around.
+    bool empty() const {
+        return m_bottom.load(std::memory_order_relaxed) <=
+            m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct buffer {
+        explicit buffer(std::size_t size)
+            : mask(size - 1)
+            , slots(new std::atomic<T*>[size]) {}
+
+        T* get(std::int64_t i) const {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+        void put(std::int64_t i, T* x) {
+            slots[i & mask].store(x, std::memory_order_relaxed);
+        }
+
+        const std::size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+    };
+
+    buffer* grow(buffer* a, std::int64_t t, std::int64_t b) {
+        std::unique_ptr<buffer> n (new buffer(2 * (a->mask + 1)));
+        for (auto i = t; i != b; ++i)
+            n->put(i, a->get(i));
+        m_buffers.push_back(std::move(n));
+        a = m_buffers.back().get();
+        m_array.store(a, std::memory_order_release);
+        return a;
+    }
+
+    std::atomic<std::int64_t> m_top;
+    char _[64];
+    std::atomic<std::int64_t> m_bottom;
+    std::atomic<buffer*> m_array;
+    std::vector<std::unique_ptr<buffer> > m_buffers;
+};
+
+}
+#endif